@@ -11,6 +11,8 @@
 #define I2C_FREQ 400*1000
 
 #define RGB_PIN 13
+/* Buttons, cab and aime LEDs on 3 consecutive pins, driven in parallel */
+// #define RGB_PARALLEL_PIN_BASE 13
 #define RGB_ORDER GRB // or RGB
 #define RGB_BUTTON_MAP { 5, 4, 3, 2, 1, 0, 7, 6 }
 
@@ -22,6 +24,14 @@
 #define BUTTON_NKRO_MAP_P1 "\x1a\x08\x07\x06\x1b\x1d\x04\x14\x20\x3a\x3b\x3c"
 #define BUTTON_NKRO_MAP_P2 "\x60\x61\x5e\x5b\x5a\x59\x5c\x5f\x55\x3a\x3b\x3c"
 
+/* Touch zones in NKRO touch mode, buttons stay on P1 keys
+   A1-A8: 12456789 B1-B8: RTYUIOPG C1-C2: HJ D1-D8: KLMNBVFS E1-E8: (Numpad)12345678 */
+#define TOUCH_NKRO_MAP "\x1e\x1f\x21\x22\x23\x24\x25\x26" \
+                       "\x15\x17\x1c\x18\x0c\x12\x13\x0a" \
+                       "\x0b\x0d" \
+                       "\x0e\x0f\x10\x11\x05\x19\x09\x16" \
+                       "\x59\x5a\x5b\x5c\x5d\x5e\x5f\x60"
+
 #define TOUCH_MAP { E3, A2, B2, D2, E2, A1, B1, D1, E1, C2, A8, B8, \
                     D8, E8, A7, B7, D7, E7, A6, B6, D6, E6, A5, B5, \
                     D5, E5, C1, A4, B4, D4, E4, A3, B3, D3, XX, XX }
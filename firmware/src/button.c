@@ -15,6 +15,7 @@
 
 #include "config.h"
 #include "board_defs.h"
+#include "hot.h"
 
 static const uint8_t gpio_def[] = BUTTON_DEF;
 static uint8_t gpio_real[] = BUTTON_DEF;
@@ -84,11 +85,16 @@ uint8_t button_default_gpio(int id)
 
 static uint16_t button_reading;
 
-/* If a switch flips, it freezes for a while */
+/* If a switch flips, it freezes for a while, at least two scans so a
+   bounce can't get through at slow scan rates */
 #define DEBOUNCE_FREEZE_TIME_US 3000
-void button_update()
+void HOT(button_update)()
 {
     uint64_t now = time_us_64();
+    uint32_t freeze = mai_cfg->scan.period * 2;
+    if (freeze < DEBOUNCE_FREEZE_TIME_US) {
+        freeze = DEBOUNCE_FREEZE_TIME_US;
+    }
     uint16_t buttons = 0;
 
     for (int i = BUTTON_NUM - 1; i >= 0; i--) {
@@ -97,7 +103,7 @@ void button_update()
         if (now >= sw_freeze_time[i]) {
             if (sw_pressed != sw_val[i]) {
                 sw_val[i] = sw_pressed;
-                sw_freeze_time[i] = now + DEBOUNCE_FREEZE_TIME_US;
+                sw_freeze_time[i] = now + freeze;
             }
         }
 
@@ -110,7 +116,7 @@ void button_update()
     button_reading = buttons;
 }
 
-uint16_t button_read()
+uint16_t HOT(button_read)()
 {
     return button_reading;
 }
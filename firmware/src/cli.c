@@ -85,6 +85,11 @@ void cli_fps_count(int core)
     counter[core] = 0;
 }
 
+int cli_fps(int core)
+{
+    return fps[core];
+}
+
 static void handle_fps(int argc, char *argv[])
 {
     printf("FPS: core 0: %d, core 1: %d\n", fps[0], fps[1]);
@@ -0,0 +1,173 @@
+/*
+ * System Clock Profiles
+ * WHowe <github.com/whowechina>
+ *
+ * Core voltage goes up before the clock does and comes down after it.
+ * The self-test measures clk_sys and clk_usb with the frequency counter
+ * and checks that I2C and the WS2812 PIO can still hit their rates from
+ * the new clk_peri and clk_sys.
+ *
+ * A profile that passes the self-test can still hang the chip later in
+ * boot. The profile being tried goes into a watchdog scratch register
+ * and the watchdog runs until boot is done. If it bites, the next boot
+ * finds the mark and falls back to the default profile.
+ */
+
+#include "clock.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/vreg.h"
+#include "hardware/i2c.h"
+#include "hardware/watchdog.h"
+#include "hardware/structs/watchdog.h"
+
+#include "board_defs.h"
+
+#define TRY_MAGIC 0x6d630000 // "mc" in the high half, profile in the low
+#define TRY_SCRATCH 0 // SDK reboot code uses 4..7
+#define BOOT_WATCHDOG_MS 3000
+
+#define WS2812_FREQ 800000
+#define WS2812_CYCLES 10 // T1 + T2 + T3 of ws2812.pio
+
+static const struct {
+    uint32_t khz;
+    int vreg;
+} profiles[CLOCK_PROFILE_NUM] = {
+    { 150000, VREG_VOLTAGE_1_10 },
+    { 125000, VREG_VOLTAGE_1_10 },
+    { 200000, VREG_VOLTAGE_1_15 },
+    { 250000, VREG_VOLTAGE_1_20 },
+};
+
+static uint8_t active = CLOCK_PROFILE_DEFAULT;
+static clock_fault_t fault = CLOCK_OK;
+static uint8_t failed = CLOCK_PROFILE_DEFAULT;
+static int vreg_now = VREG_VOLTAGE_1_10; // power-on default
+
+static bool within(uint32_t value, uint32_t target, uint32_t permille)
+{
+    uint32_t diff = abs((int32_t)(value - target));
+    return (uint64_t)diff * 1000 <= (uint64_t)target * permille;
+}
+
+static bool apply(uint8_t profile)
+{
+    int vreg = profiles[profile].vreg;
+    if (vreg > vreg_now) {
+        vreg_set_voltage(vreg);
+        sleep_ms(10); // let it settle
+    }
+
+    if (!set_sys_clock_khz(profiles[profile].khz, false)) {
+        return false;
+    }
+
+    if (vreg < vreg_now) {
+        vreg_set_voltage(vreg);
+    }
+    vreg_now = vreg;
+    return true;
+}
+
+static clock_fault_t self_test(uint8_t profile)
+{
+    if (!within(frequency_count_khz(CLOCKS_FC0_SRC_VALUE_CLK_SYS),
+                profiles[profile].khz, 10)) {
+        return CLOCK_FAULT_SYS;
+    }
+
+    if (!within(frequency_count_khz(CLOCKS_FC0_SRC_VALUE_CLK_USB), 48000, 5)) {
+        return CLOCK_FAULT_USB;
+    }
+
+    if (!within(i2c_init(I2C_PORT, I2C_FREQ), I2C_FREQ, 50)) {
+        return CLOCK_FAULT_I2C;
+    }
+
+    /* PIO divider is 16.8 fixed point, same as ws2812_program_init() gets */
+    uint64_t div256 = (uint64_t)clock_get_hz(clk_sys) * 256 / (WS2812_FREQ * WS2812_CYCLES);
+    if ((div256 < 256) || (div256 >= (65536 << 8))) {
+        return CLOCK_FAULT_WS2812;
+    }
+    uint32_t bit_rate = (uint64_t)clock_get_hz(clk_sys) * 256 / div256 / WS2812_CYCLES;
+    if (!within(bit_rate, WS2812_FREQ, 10)) {
+        return CLOCK_FAULT_WS2812;
+    }
+
+    return CLOCK_OK;
+}
+
+void clock_init(uint8_t profile)
+{
+    if (profile >= CLOCK_PROFILE_NUM) {
+        profile = CLOCK_PROFILE_DEFAULT;
+    }
+
+    uint32_t tried = watchdog_hw->scratch[TRY_SCRATCH];
+    watchdog_hw->scratch[TRY_SCRATCH] = 0;
+    if (watchdog_caused_reboot() && ((tried & 0xffff0000) == TRY_MAGIC)) {
+        fault = CLOCK_FAULT_HANG;
+        failed = tried & 0xff;
+        profile = CLOCK_PROFILE_DEFAULT;
+    }
+
+    if (profile != CLOCK_PROFILE_DEFAULT) {
+        clock_fault_t result = apply(profile) ? self_test(profile) : CLOCK_FAULT_SET;
+        if (result == CLOCK_OK) {
+            active = profile;
+            watchdog_hw->scratch[TRY_SCRATCH] = TRY_MAGIC | profile;
+            watchdog_enable(BOOT_WATCHDOG_MS, true);
+            return;
+        }
+        fault = result;
+        failed = profile;
+    }
+
+    apply(CLOCK_PROFILE_DEFAULT);
+    active = CLOCK_PROFILE_DEFAULT;
+}
+
+void clock_boot_done()
+{
+    hw_clear_bits(&watchdog_hw->ctrl, WATCHDOG_CTRL_ENABLE_BITS);
+    watchdog_hw->scratch[TRY_SCRATCH] = 0;
+}
+
+uint8_t clock_profile()
+{
+    return active;
+}
+
+uint32_t clock_profile_khz(uint8_t profile)
+{
+    if (profile >= CLOCK_PROFILE_NUM) {
+        return 0;
+    }
+    return profiles[profile].khz;
+}
+
+clock_fault_t clock_fault(uint8_t *failed_profile)
+{
+    if (failed_profile) {
+        *failed_profile = failed;
+    }
+    return fault;
+}
+
+const char *clock_fault_name(clock_fault_t fault)
+{
+    static const char *names[] = {
+        "none", "PLL setting", "clk_sys measurement", "clk_usb measurement",
+        "I2C baud rate", "WS2812 bit rate", "boot hang",
+    };
+    if (fault >= count_of(names)) {
+        return "unknown";
+    }
+    return names[fault];
+}
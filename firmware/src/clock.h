@@ -0,0 +1,44 @@
+/*
+ * System Clock Profiles
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Default first, configs saved before profiles existed have 0 here */
+enum clock_profile {
+    CLOCK_150MHZ,
+    CLOCK_125MHZ,
+    CLOCK_200MHZ,
+    CLOCK_250MHZ,
+    CLOCK_PROFILE_NUM
+};
+
+#define CLOCK_PROFILE_DEFAULT CLOCK_150MHZ
+
+typedef enum {
+    CLOCK_OK,
+    CLOCK_FAULT_SET, // PLL can't make it
+    CLOCK_FAULT_SYS, // measured clk_sys is off
+    CLOCK_FAULT_USB, // clk_usb is not 48MHz
+    CLOCK_FAULT_I2C, // I2C baud rate too far off
+    CLOCK_FAULT_WS2812, // PIO divider can't make the LED bit rate
+    CLOCK_FAULT_HANG, // last boot with it never finished
+} clock_fault_t;
+
+/* Before anything derives timing from clk_sys. Falls back to the default
+   profile when the requested one fails its self-test, or when the last
+   boot with it hung and the watchdog had to restart. */
+void clock_init(uint8_t profile);
+void clock_boot_done(); // end of init, stops the boot watchdog
+
+uint8_t clock_profile();
+uint32_t clock_profile_khz(uint8_t profile);
+clock_fault_t clock_fault(uint8_t *failed_profile);
+const char *clock_fault_name(clock_fault_t fault);
+
+#endif
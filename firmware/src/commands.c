@@ -6,8 +6,11 @@
 
 #include "pico/stdio.h"
 #include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/xip_ctrl.h"
 
 #include "tusb.h"
+#include "usb_descriptors.h"
 
 #include "mpr121.h"
 #include "touch.h"
@@ -16,6 +19,15 @@
 #include "save.h"
 #include "cli.h"
 
+#include "rgb.h"
+#include "effect.h"
+#include "sof.h"
+#include "sched.h"
+#include "prof.h"
+#include "trace.h"
+#include "hot.h"
+#include "clock.h"
+
 #include "aime.h"
 #include "nfc.h"
 
@@ -57,15 +69,81 @@ static void disp_sense()
            mai_cfg->sense.debounce_touch, mai_cfg->sense.debounce_release);
 }
 
+static const char *gout_led_names[] = {
+    "b1", "b2", "b3", "b4", "b5", "b6", "b7", "b8", "body", "ext", "side"
+};
+
 static void disp_hid()
 {
     printf("[HID]\n");
-    const char *nkro[] = {"off", "key1", "key2"};
-    printf("  IO4: %s, NKRO: %s\n", mai_cfg->hid.io4 ? "on" : "off",
-           mai_cfg->hid.nkro <= 2 ? nkro[mai_cfg->hid.nkro] : "key1");
+    const char *nkro[] = {"off", "key1", "key2", "touch"};
+    printf("  IO4: %s, NKRO: %s, Touch Report: %s\n", mai_cfg->hid.io4 ? "on" : "off",
+           mai_cfg->hid.nkro <= 3 ? nkro[mai_cfg->hid.nkro] : "key1",
+           mai_cfg->touch_hid.report ? "on" : "off");
+    if (mai_cfg->hid.nkro == 3) {
+        printf("  Touch Keys:");
+        for (int i = 0; i < sizeof(mai_cfg->touch_hid.keymap); i++) {
+            printf("%s%s:%-3d", i % 8 == 0 ? "\n   " : " ",
+                   touch_key_name(i), mai_cfg->touch_hid.keymap[i]);
+        }
+        printf("\n");
+    }
     if (mai_runtime.key_stuck) {
         printf("  !!! Button stuck, force IO4 only !!!\n");
     }
+    printf("  GOUT:");
+    for (int i = 0; i < count_of(mai_cfg->gout.map); i++) {
+        uint8_t led = mai_cfg->gout.map[i];
+        printf(" %d:%s", i, led < count_of(gout_led_names) ? gout_led_names[led] : "-");
+    }
+    printf("\n");
+}
+
+static void print_ms(const char *title, uint32_t us)
+{
+    printf("%s%lu.%lums", title, us / 1000, us % 1000 / 100);
+}
+
+static void disp_usb()
+{
+    printf("[USB]\n");
+    printf("  Profile: %s, next start: %s\n  Ports:",
+           usb_profile_name(mai_runtime.boot.profile),
+           usb_profile_name(mai_cfg->usb.profile));
+    for (int i = 0; i < USB_PORT_NUM; i++) {
+        if (usb_instance(i) >= 0) {
+            printf(" %s", usb_port_name(i));
+        }
+    }
+    printf("\n");
+    print_ms("  USB up at ", mai_runtime.boot.usb_init_us);
+    print_ms(", ready at ", mai_runtime.boot.ready_us);
+    if (mai_runtime.boot.mount_us) {
+        print_ms(", mounted at ", mai_runtime.boot.mount_us);
+        print_ms(" (enumeration ", mai_runtime.boot.mount_us - mai_runtime.boot.usb_init_us);
+        printf(")");
+    }
+    printf("\n");
+}
+
+static void disp_sof()
+{
+    sof_stat_t stat;
+    sof_get_stat(&stat);
+
+    printf("[SOF]\n");
+    printf("  Sync: %s, offset: %dus, locked: %s, SOF count: %lu\n",
+           mai_cfg->sof.sync ? "ON" : "OFF", mai_cfg->sof.offset,
+           sof_locked() ? "yes" : "no", stat.count);
+    printf("  SOF period jitter: max %luus\n", stat.period_jitter_max);
+    printf("  Sampled before SOF: avg %luus, min %luus, max %luus (jitter %luus)\n",
+           stat.lead_avg, stat.lead_min, stat.lead_max, stat.lead_max - stat.lead_min);
+
+    const char *rx_names[] = { "LED", "Aime" };
+    for (int i = 0; i < SOF_RX_NUM; i++) {
+        printf("  %s command latency: avg %luus, max %luus (%lu commands)\n",
+               rx_names[i], stat.rx[i].avg, stat.rx[i].max, stat.rx[i].count);
+    }
 }
 
 static void disp_aime()
@@ -109,23 +187,27 @@ static void disp_tweak()
            mai_cfg->tweak.main_button_active_high ? "ON" : "OFF");
     printf("  Aux Buttons Active-High: %s\n",
            mai_cfg->tweak.aux_button_active_high ? "ON" : "OFF");
+    printf("  Vendor Port: %s (re-plug to apply)\n",
+           mai_cfg->tweak.vendor_port ? "ON" : "OFF");
 }
 
 #define ARRAYSIZE(x) (sizeof(x) / sizeof(x[0]))
 
 void handle_display(int argc, char *argv[])
 {
-    const char *usage = "Usage: display [rgb|sense|hid|gpio|touch|aime|tweak]\n";
+    const char *usage = "Usage: display [rgb|sense|hid|usb|sof|gpio|touch|aime|tweak]\n";
     if (argc > 1) {
         printf(usage);
         return;
     }
 
-    const char *choices[] = {"rgb", "sense", "hid", "gpio", "touch", "aime", "tweak"};
+    const char *choices[] = {"rgb", "sense", "hid", "usb", "sof", "gpio", "touch", "aime", "tweak"};
     static void (*disp_funcs[])() = {
         disp_rgb,
         disp_sense,
         disp_hid,
+        disp_usb,
+        disp_sof,
         disp_gpio,
         disp_touch,
         disp_aime,
@@ -218,15 +300,65 @@ static void handle_stat(int argc, char *argv[])
     }
 }
 
+static bool handle_hid_report(int argc, char *argv[])
+{
+    const char *onoff[] = { "on", "off" };
+    int match = (argc == 1) ? cli_match_prefix(onoff, 2, argv[0]) : -1;
+    if (match < 0) {
+        return false;
+    }
+    mai_cfg->touch_hid.report = (match == 0);
+    if (mai_cfg->usb.profile == USB_PROFILE_FULL) {
+        printf("Full USB profile adds or drops the interface, re-plug to apply.\n");
+    }
+    return true;
+}
+
+static bool handle_hid_key(int argc, char *argv[])
+{
+    if (argc != 2) {
+        return false;
+    }
+    int key = touch_key_by_name(argv[0]);
+    int code = cli_extract_non_neg_int(argv[1], 0);
+    if ((key < 0) || (key >= sizeof(mai_cfg->touch_hid.keymap)) ||
+        (code < 0) || (code >= 120)) {
+        return false;
+    }
+    mai_cfg->touch_hid.keymap[key] = code;
+    return true;
+}
+
 static void handle_hid(int argc, char *argv[])
 {
-    const char *usage = "Usage: hid <io4|key1|key2|off>\n";
+    const char *usage = "Usage: hid <io4|key1|key2|touch|off>\n"
+                        "       hid report <on|off>\n"
+                        "       hid key <A1..E8> <keycode, 0 for none>\n";
+    if (argc < 1) {
+        printf(usage);
+        return;
+    }
+
+    const char *sub[] = {"report", "key"};
+    int match_sub = cli_match_prefix(sub, count_of(sub), argv[0]);
+    if (match_sub >= 0) {
+        bool ok = (match_sub == 0) ? handle_hid_report(argc - 1, argv + 1)
+                                   : handle_hid_key(argc - 1, argv + 1);
+        if (!ok) {
+            printf(usage);
+            return;
+        }
+        config_changed();
+        disp_hid();
+        return;
+    }
+
     if (argc != 1) {
         printf(usage);
         return;
     }
 
-    const char *choices[] = {"io4", "key1", "key2", "off"};
+    const char *choices[] = {"io4", "key1", "key2", "touch", "off"};
     int match = cli_match_prefix(choices, count_of(choices), argv[0]);
     if (match < 0) {
         printf(usage);
@@ -243,6 +375,10 @@ static void handle_hid(int argc, char *argv[])
             mai_cfg->hid.nkro = 2;
             break;
         case 3:
+            mai_cfg->hid.io4 = 0;
+            mai_cfg->hid.nkro = 3;
+            break;
+        case 4:
             mai_cfg->hid.io4 = 0;
             mai_cfg->hid.nkro = 0;
             break;
@@ -256,6 +392,292 @@ static void handle_hid(int argc, char *argv[])
     disp_hid();
 }
 
+static void handle_gout(int argc, char *argv[])
+{
+    const char *usage = "Usage: gout <0..13> <b1..b8|body|ext|side|none>\n";
+    if (argc != 2) {
+        printf(usage);
+        return;
+    }
+
+    int bit = cli_extract_non_neg_int(argv[0], 0);
+    if ((bit < 0) || (bit >= count_of(mai_cfg->gout.map))) {
+        printf(usage);
+        return;
+    }
+
+    uint8_t led = GOUT_LED_NONE;
+    if (strcasecmp(argv[1], "none") != 0) {
+        int match = cli_match_prefix(gout_led_names, count_of(gout_led_names), argv[1]);
+        if (match < 0) {
+            printf(usage);
+            return;
+        }
+        led = match;
+    }
+
+    mai_cfg->gout.map[bit] = led;
+    config_changed();
+    disp_hid();
+}
+
+static void handle_usb(int argc, char *argv[])
+{
+    const char *usage = "Usage: usb [full|arcade|pc|debug]\n"
+                        "    full: IO4, NKRO, touch HID and all serial ports\n"
+                        "  arcade: IO4, touch and LED ports\n"
+                        "      pc: NKRO and touch HID\n"
+                        "   debug: touch HID and vendor port\n"
+                        "  Command line port is always there. Each layout has its\n"
+                        "  own device revision, the host may need a re-plug to\n"
+                        "  bind drivers afresh after a change.\n";
+    if (argc == 0) {
+        disp_usb();
+        return;
+    }
+
+    const char *profiles[] = { "full", "arcade", "pc", "debug" };
+    int match = (argc == 1) ? cli_match_prefix(profiles, count_of(profiles), argv[0]) : -1;
+    if (match < 0) {
+        printf(usage);
+        return;
+    }
+
+    mai_cfg->usb.profile = match;
+    config_changed();
+    disp_usb();
+}
+
+static void disp_sched()
+{
+    printf("[Scheduler]\n");
+    printf("  %-8s %4s %7s %7s %9s %7s %7s %7s %7s %8s\n", "Task", "Prio",
+           "Period", "Budget", "Runs", "Missed", "Overrun", "Skipped", "Max",
+           "Late");
+    for (int i = 0; i < sched_num(); i++) {
+        sched_stat_t stat;
+        sched_get_stat(i, &stat);
+        printf("  %-8s %4d %5luus %5luus %9lu %7lu %7lu %7lu %5luus %6luus\n",
+               stat.name, stat.priority, stat.period, stat.budget, stat.runs,
+               stat.missed, stat.overrun, stat.skipped, stat.max_us,
+               stat.late_max);
+    }
+    printf("  Scan catch-up: %d\n", mai_cfg->scan.catchup);
+}
+
+static void disp_lateness(int id)
+{
+    static const char bar_full[] = "########################################";
+
+    uint32_t hist[SCHED_LATE_BUCKETS];
+    sched_get_lateness(id, hist);
+
+    uint32_t total = 0;
+    for (int i = 0; i < SCHED_LATE_BUCKETS; i++) {
+        total += hist[i];
+    }
+
+    sched_stat_t stat;
+    sched_get_stat(id, &stat);
+    printf("[%s start lateness, %lu runs]\n", stat.name, total);
+    for (int i = 0; i < SCHED_LATE_BUCKETS; i++) {
+        if (hist[i] == 0) {
+            continue;
+        }
+        int bar = (uint64_t)hist[i] * 40 / total;
+        if (i == 0) {
+            printf("  %17s %9lu %.*s\n", "on time", hist[i], bar, bar_full);
+        } else if (i == SCHED_LATE_BUCKETS - 1) {
+            printf("  %7lu+ us      %9lu %.*s\n", 1UL << (i - 1), hist[i], bar, bar_full);
+        } else {
+            printf("  %7lu-%-6lu us %9lu %.*s\n", 1UL << (i - 1), (1UL << i) - 1,
+                   hist[i], bar, bar_full);
+        }
+    }
+}
+
+static void handle_sched(int argc, char *argv[])
+{
+    const char *usage = "Usage: sched [reset]\n"
+                        "       sched late [task]\n"
+                        "       sched catchup <0..10>\n"
+                        "  catchup: late scans run back to back after a stall,\n"
+                        "           0 skips straight to now\n";
+    if (argc == 0) {
+        disp_sched();
+        return;
+    }
+
+    const char *choices[] = { "reset", "late", "catchup" };
+    int match = cli_match_prefix(choices, count_of(choices), argv[0]);
+
+    if ((match == 0) && (argc == 1)) {
+        sched_reset_stat();
+        return;
+    }
+
+    if ((match == 1) && (argc <= 2)) {
+        int id = sched_find(argc == 2 ? argv[1] : "scan");
+        if (id < 0) {
+            printf("No such task.\n");
+            return;
+        }
+        disp_lateness(id);
+        return;
+    }
+
+    if ((match == 2) && (argc == 2)) {
+        int runs = cli_extract_non_neg_int(argv[1], 0);
+        if ((runs < 0) || (runs > SCAN_CATCHUP_MAX)) {
+            printf(usage);
+            return;
+        }
+        mai_cfg->scan.catchup = runs;
+        sched_set_catchup(sched_find("scan"), runs);
+        config_changed();
+        disp_sched();
+        return;
+    }
+
+    printf(usage);
+}
+
+static void disp_rate()
+{
+    uint32_t period = mai_cfg->scan.period;
+    int achieved = cli_fps(0);
+    printf("[Scan Rate]\n");
+    printf("  Requested: %luus (%luHz), achieved: %dHz (%d.%d%%)\n",
+           period, 1000000 / period, achieved,
+           achieved * period / 10000, achieved * period / 1000 % 10);
+}
+
+static void handle_rate(int argc, char *argv[])
+{
+    const char *usage = "Usage: rate [period]\n"
+                        "  period: touch and HID scan period, 250..2000us\n";
+    if (argc == 0) {
+        disp_rate();
+        return;
+    }
+
+    int period = cli_extract_non_neg_int(argv[0], 0);
+    if ((argc > 1) || (period < SCAN_PERIOD_MIN) || (period > SCAN_PERIOD_MAX)) {
+        printf(usage);
+        return;
+    }
+
+    mai_cfg->scan.period = period;
+    config_changed();
+    printf("Scan period set to %dus, achieved rate shows after a second.\n", period);
+}
+
+extern char __data_start__[], __data_end__[], __bss_start__[], __bss_end__[];
+
+static void handle_xip(int argc, char *argv[])
+{
+    if ((argc == 1) &&
+        (strncasecmp(argv[0], "reset", strlen(argv[0])) == 0)) {
+        xip_ctrl_hw->ctr_hit = 0; // any write clears
+        xip_ctrl_hw->ctr_acc = 0;
+        return;
+    } else if (argc != 0) {
+        printf("Usage: xip [reset]\n");
+        return;
+    }
+
+    uint32_t hit = xip_ctrl_hw->ctr_hit;
+    uint32_t acc = xip_ctrl_hw->ctr_acc;
+    uint32_t permille = acc ? (uint64_t)hit * 1000 / acc : 1000;
+    printf("[XIP Cache]\n");
+    printf("  Hot path in SRAM: %s, SRAM data+code: %d, bss: %d bytes\n",
+           HOT_PATH_IN_SRAM ? "yes" : "no", __data_end__ - __data_start__,
+           __bss_end__ - __bss_start__);
+    printf("  Accesses: %lu, misses: %lu, hit rate: %lu.%lu%%\n",
+           acc, acc - hit, permille / 10, permille % 10);
+    printf("  Per task run (both cores count):\n");
+    for (int i = 0; i < sched_num(); i++) {
+        sched_stat_t stat;
+        sched_get_stat(i, &stat);
+        if (stat.runs == 0) {
+            continue;
+        }
+        printf("  %8s: %6lu accesses, %5lu misses\n", stat.name,
+               stat.xip_acc / stat.runs, stat.xip_miss / stat.runs);
+    }
+}
+
+static void disp_clock()
+{
+    printf("[Clock]\n");
+    printf("  Profile: %luMHz, running: %luMHz\n",
+           clock_profile_khz(mai_cfg->clock.profile) / 1000,
+           clock_profile_khz(clock_profile()) / 1000);
+    printf("  Measured: clk_sys %lukHz, clk_peri %lukHz, clk_usb %lukHz\n",
+           frequency_count_khz(CLOCKS_FC0_SRC_VALUE_CLK_SYS),
+           frequency_count_khz(CLOCKS_FC0_SRC_VALUE_CLK_PERI),
+           frequency_count_khz(CLOCKS_FC0_SRC_VALUE_CLK_USB));
+
+    uint8_t failed;
+    clock_fault_t fault = clock_fault(&failed);
+    if (fault != CLOCK_OK) {
+        printf("  %luMHz failed at boot: %s, fell back.\n",
+               clock_profile_khz(failed) / 1000, clock_fault_name(fault));
+    }
+}
+
+static void handle_clock(int argc, char *argv[])
+{
+    const char *usage = "Usage: clock [125|150|200|250]\n"
+                        "  System clock in MHz, takes effect at next start.\n"
+                        "  A profile failing its self-test falls back to 150.\n";
+    if (argc == 0) {
+        disp_clock();
+        return;
+    }
+
+    const char *choices[] = { "150", "125", "200", "250" }; // profile order
+    int match = cli_match_prefix(choices, count_of(choices), argv[0]);
+    if ((argc > 1) || (match < 0)) {
+        printf(usage);
+        return;
+    }
+
+    mai_cfg->clock.profile = match;
+    config_changed();
+    disp_clock();
+}
+
+static void handle_sof(int argc, char *argv[])
+{
+    const char *usage = "Usage: sof [on|off] [offset]\n"
+                        "       sof reset\n"
+                        "  offset: touch scan start after SOF, 0..999us\n";
+    if (argc == 0) {
+        disp_sof();
+        return;
+    }
+
+    if ((argc == 1) && (strncasecmp(argv[0], "reset", strlen(argv[0])) == 0)) {
+        sof_reset_stat();
+        return;
+    }
+
+    const char *onoff[] = { "on", "off" };
+    int match = cli_match_prefix(onoff, 2, argv[0]);
+    int offset = (argc == 2) ? cli_extract_non_neg_int(argv[1], 0) : mai_cfg->sof.offset;
+    if ((argc > 2) || (match < 0) || (offset < 0) || (offset > 999)) {
+        printf(usage);
+        return;
+    }
+
+    mai_cfg->sof.sync = (match == 0);
+    mai_cfg->sof.offset = offset;
+    sof_reset_stat();
+    config_changed();
+    disp_sof();
+}
+
 static void handle_filter(int argc, char *argv[])
 {
     const char *usage = "Usage: filter <first> <second> [interval]\n"
@@ -434,18 +856,181 @@ static void handle_raw()
     print_readings("E", zones + 26, 8);
 }
 
+static void handle_effect(int argc, char *argv[])
+{
+    if ((argc == 1) &&
+        (strncasecmp(argv[0], "reset", strlen(argv[0])) == 0)) {
+        effect_reset_stat();
+        return;
+    } else if (argc != 0) {
+        printf("Usage: effect [reset]\n");
+        return;
+    }
+
+    uint32_t budget = clock_get_hz(clk_sys) / 250; // one LED frame
+    printf("Light effect cycles (frame budget %lu):\n", budget);
+    for (int i = 0; i < effect_num(); i++) {
+        uint32_t last, peak;
+        effect_cycles(i, &last, &peak);
+        printf("  %8s: last %6lu, peak %6lu (%lu.%02lu%%)\n", effect_name(i),
+               last, peak, peak * 100 / budget, peak * 10000 / budget % 100);
+    }
+}
+
+static void disp_rgb_bench()
+{
+#ifdef RGB_BENCH
+    rgb_bench_t bench;
+    rgb_bench(&bench);
+    printf("LED frame cycles, now vs. per-LED divides before:\n");
+    printf("  fade (24 ends): %6lu vs. %6lu\n", bench.fade, bench.legacy_fade);
+    printf("  level (%d pixels): %6lu vs. %6lu\n", bench.pixels,
+           bench.level, bench.legacy_level);
+#else
+    printf("LED benchmark not built in, build with -DRGB_BENCH=ON.\n");
+#endif
+}
+
+static void handle_prof(int argc, char *argv[])
+{
+    if ((argc == 1) &&
+        (strncasecmp(argv[0], "reset", strlen(argv[0])) == 0)) {
+        prof_reset();
+        return;
+    } else if ((argc == 1) &&
+               (strncasecmp(argv[0], "rgb", strlen(argv[0])) == 0)) {
+        disp_rgb_bench();
+        return;
+    } else if (argc != 0) {
+        printf("Usage: prof [reset|rgb]\n");
+        return;
+    }
+
+    uint32_t mhz = clock_get_hz(clk_sys) / 1000000;
+    printf("Stage cost in us (min/mean/max, p99 is an upper bound):\n");
+    for (int core = 0; core < 2; core++) {
+        printf("[Core %d]\n", core);
+        for (int i = 0; i < PROF_NUM; i++) {
+            prof_stat_t stat;
+            prof_get_stat(core, i, &stat);
+            if (stat.count == 0) {
+                continue;
+            }
+            printf("  %8s: %5lu %5lu %6lu, p99 < %6lu (%lu runs)\n",
+                   prof_name(i), stat.min / mhz, stat.mean / mhz,
+                   stat.max / mhz, stat.p99 / mhz + 1, stat.count);
+        }
+    }
+}
+
+static void trace_dump(bool csv)
+{
+    if (csv) {
+        printf("core,ts_us,event,a,b\n");
+    }
+
+    for (int core = 0; core < 2; core++) {
+        uint32_t head = trace_head(core);
+        uint32_t seq = head > TRACE_DEPTH ? head - TRACE_DEPTH : 0;
+        for (; seq < head; seq++) {
+            trace_entry_t entry;
+            if (!trace_read(core, seq, &entry)) {
+                continue;
+            }
+            if (csv) {
+                printf("%d,%lu,%s,%u,%lu\n", core, entry.ts,
+                       trace_name(entry.id), entry.a, entry.b);
+            } else {
+                printf("  %d %10lu %-13s %5u %08lx\n", core, entry.ts,
+                       trace_name(entry.id), entry.a, entry.b);
+            }
+        }
+    }
+}
+
+static void handle_trace(int argc, char *argv[])
+{
+    const char *usage = "Usage: trace [dump|csv|clear|on|off]\n"
+                        "    dump: events of both cores, oldest first\n"
+                        "     csv: same, as CSV for host tools\n";
+    if (argc > 1) {
+        printf(usage);
+        return;
+    }
+
+    if (argc == 0) {
+        printf("[Trace]\n  %s, core 0: %lu events, core 1: %lu events\n",
+               trace_enabled() ? "ON" : "OFF", trace_head(0), trace_head(1));
+        return;
+    }
+
+    const char *choices[] = { "dump", "csv", "clear", "on", "off" };
+    switch (cli_match_prefix(choices, count_of(choices), argv[0])) {
+        case 0:
+            trace_dump(false);
+            break;
+        case 1:
+            trace_dump(true);
+            break;
+        case 2:
+            trace_clear();
+            break;
+        case 3:
+            trace_enable(true);
+            break;
+        case 4:
+            trace_enable(false);
+            break;
+        default:
+            printf(usage);
+            break;
+    }
+}
+
 static void handle_whoami()
 {
-    const char *msg[] = {"\nThis is Command Line port.\n", "\nThis is Touch port.\n", "\nThis is LED port.\n"};
-    for (int i = 0; i < 3; i++) {
-        tud_cdc_n_write(i, msg[i], strlen(msg[i]));
-        tud_cdc_n_write_flush(i);
+    const char *msg[] = {"\nThis is Command Line port.\n", "\nThis is Touch port.\n",
+                         "\nThis is LED port.\n", "\nThis is AIME port.\n"};
+    for (int i = 0; i < 4; i++) {
+        int itf = usb_instance(USB_CDC_CLI + i);
+        if (itf >= 0) {
+            tud_cdc_n_write(itf, msg[i], strlen(msg[i]));
+            tud_cdc_n_write_flush(itf);
+        }
     }
 }
 
-static void handle_save()
+static void disp_save_op(const char *name, const save_op_stat_t *op)
+{
+    printf("  %7s: %lu times, last %luus, max %luus\n", name,
+           op->count, op->last_us, op->max_us);
+}
+
+static void handle_save(int argc, char *argv[])
 {
-    save_request(true);
+    if (argc == 0) {
+        save_request(true);
+        printf("Save requested.\n");
+        return;
+    }
+
+    if ((argc != 1) ||
+        (strncasecmp(argv[0], "stat", strlen(argv[0])) != 0)) {
+        printf("Usage: save [stat]\n");
+        return;
+    }
+
+    save_stat_t stat;
+    save_get_stat(&stat);
+    printf("[Flash Save]\n");
+    printf("  Input blackout per operation:\n");
+    disp_save_op("program", &stat.program);
+    disp_save_op("erase", &stat.erase);
+    printf("  Saves put off for an erase: %lu\n", stat.held);
+    printf("  Latest record: #%lu, next goes to sector %d slot %d\n",
+           stat.seq, stat.sector, stat.slot);
+    printf("  Loaded version %d (current %d) in %luus, %lu bad records passed over\n",
+           stat.version, CONFIG_VERSION, stat.load_us, stat.bad_records);
 }
 
 static void handle_gpio(int argc, char *argv[])
@@ -620,7 +1205,8 @@ static void handle_tweak(int argc, char *argv[])
     const char *usage = "Usage: tweak <option> <on|off>\n"
                         "Options:\n"
                         "    main_button_active_high\n"
-                        "    aux_button_active_high\n";
+                        "    aux_button_active_high\n"
+                        "    vendor_port\n";
     if (argc != 2) {
         printf(usage);
         return;
@@ -629,11 +1215,12 @@ static void handle_tweak(int argc, char *argv[])
     const char *options[] = {
         "main_button_active_high",
         "aux_button_active_high",
+        "vendor_port",
     };
 
     const char *switches[] = { "on", "off" };
 
-    int option = cli_match_prefix(options, 2, argv[0]);
+    int option = cli_match_prefix(options, count_of(options), argv[0]);
     int on_off = cli_match_prefix(switches, 2, argv[1]);
     if ((option < 0) || (on_off < 0)) {
         printf(usage);
@@ -645,6 +1232,8 @@ static void handle_tweak(int argc, char *argv[])
         mai_cfg->tweak.main_button_active_high = active;
     } else if (option == 1) {
         mai_cfg->tweak.aux_button_active_high = active;
+    } else if (option == 2) {
+        mai_cfg->tweak.vendor_port = active;
     }
 
     config_changed();
@@ -658,12 +1247,22 @@ void commands_init()
     cli_register("level", handle_level, "Set LED brightness level.");
     cli_register("stat", handle_stat, "Display or reset statistics.");
     cli_register("hid", handle_hid, "Set HID mode.");
+    cli_register("usb", handle_usb, "Set USB profile.");
+    cli_register("sof", handle_sof, "Sync touch scan to USB SOF.");
+    cli_register("rate", handle_rate, "Set touch and HID scan rate.");
+    cli_register("xip", handle_xip, "Display flash cache stats.");
+    cli_register("clock", handle_clock, "Set system clock profile.");
+    cli_register("sched", handle_sched, "Task scheduler stats and catch-up.");
+    cli_register("gout", handle_gout, "Map IO4 general outputs to LEDs.");
     cli_register("filter", handle_filter, "Set pre-filter config.");
     cli_register("sense", handle_sense, "Set sensitivity config.");
     cli_register("debounce", handle_debounce, "Set debounce config.");
     cli_register("raw", handle_raw, "Show key raw readings.");
+    cli_register("effect", handle_effect, "Display light effect cost.");
+    cli_register("prof", handle_prof, "Display cost of each stage, or LED fade cost.");
+    cli_register("trace", handle_trace, "Event trace.");
     cli_register("whoami", handle_whoami, "Identify each com port.");
-    cli_register("save", handle_save, "Save config to flash.");
+    cli_register("save", handle_save, "Save config to flash, or show save stats.");
     cli_register("gpio", handle_gpio, "Set GPIO pins for buttons.");
     cli_register("touch", handle_touch, "Custimze touch mapping.");
     cli_register("tweak", handle_tweak, "Miscellaneous tweak options.");
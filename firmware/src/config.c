@@ -7,10 +7,13 @@
  */
 
 #include <string.h>
+#include <assert.h>
 
 #include "config.h"
 #include "save.h"
 #include "touch.h"
+#include "usb_descriptors.h"
+#include "clock.h"
 
 mai_cfg_t *mai_cfg;
 
@@ -45,6 +48,27 @@ static mai_cfg_t default_cfg = {
         .main_button_active_high = 0,
         .aux_button_active_high = 0,
     },
+    .gout = {
+        .map = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0xff, 0xff, 0xff },
+    },
+    .touch_hid = {
+        .report = 0,
+        .keymap = TOUCH_NKRO_MAP,
+    },
+    .usb = {
+        .profile = USB_PROFILE_FULL,
+    },
+    .sof = {
+        .sync = 0,
+        .offset = 500,
+    },
+    .scan = {
+        .catchup = 0,
+        .period = 1000,
+    },
+    .clock = {
+        .profile = CLOCK_PROFILE_DEFAULT,
+    },
 };
 
 mai_runtime_t mai_runtime;
@@ -71,7 +95,28 @@ static bool touch_map_valid()
     return keys > 10; // bad data results in low touch key coverage
 }
 
-static void config_loaded()
+static bool gout_map_valid()
+{
+    for (int i = 0; i < sizeof(mai_cfg->gout.map); i++) {
+        uint8_t led = mai_cfg->gout.map[i];
+        if ((led > GOUT_LED_CAB + 2) && (led != GOUT_LED_NONE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool touch_keymap_valid()
+{
+    for (int i = 0; i < sizeof(mai_cfg->touch_hid.keymap); i++) {
+        if (mai_cfg->touch_hid.keymap[i] >= 120) { // NKRO bitmap size
+            return false;
+        }
+    }
+    return true;
+}
+
+void config_validate()
 {
     if ((mai_cfg->sense.filter & 0x0f) > 3 ||
         ((mai_cfg->sense.filter >> 4) & 0x0f) > 3) {
@@ -106,6 +151,38 @@ static void config_loaded()
                sizeof(mai_cfg->alt.touch));
         config_changed();
     }
+
+    if (!gout_map_valid()) {
+        mai_cfg->gout = default_cfg.gout;
+        config_changed();
+    }
+
+    if (!touch_keymap_valid()) {
+        mai_cfg->touch_hid = default_cfg.touch_hid;
+        config_changed();
+    }
+
+    if (mai_cfg->usb.profile >= USB_PROFILE_NUM) {
+        mai_cfg->usb = default_cfg.usb;
+        config_changed();
+    }
+
+    if (mai_cfg->sof.offset >= 1000) {
+        mai_cfg->sof = default_cfg.sof;
+        config_changed();
+    }
+
+    if ((mai_cfg->scan.catchup > SCAN_CATCHUP_MAX) ||
+        (mai_cfg->scan.period < SCAN_PERIOD_MIN) ||
+        (mai_cfg->scan.period > SCAN_PERIOD_MAX)) {
+        mai_cfg->scan = default_cfg.scan;
+        config_changed();
+    }
+
+    if (mai_cfg->clock.profile >= CLOCK_PROFILE_NUM) {
+        mai_cfg->clock = default_cfg.clock;
+        config_changed();
+    }
 }
 
 void config_changed()
@@ -119,7 +196,30 @@ void config_factory_reset()
     save_request(true);
 }
 
+static_assert(sizeof(mai_cfg_t) <= SAVE_DATA_SIZE, "Config too big to save");
+
+/* Each step converts from one version to the next, so cases fall through */
+static void config_migrate(uint16_t from)
+{
+    switch (from) {
+        case 0:
+            /* Saved before records had a version. Everything after tweak
+               was reserved then and comes in as 0, not as its default. */
+            mai_cfg->tweak.vendor_port = default_cfg.tweak.vendor_port;
+            mai_cfg->gout = default_cfg.gout;
+            mai_cfg->touch_hid = default_cfg.touch_hid;
+            mai_cfg->usb = default_cfg.usb;
+            mai_cfg->sof = default_cfg.sof;
+            mai_cfg->scan = default_cfg.scan;
+            mai_cfg->clock = default_cfg.clock;
+            // fall through
+        default:
+            break;
+    }
+}
+
 void config_init()
 {
-    mai_cfg = (mai_cfg_t *)save_alloc(sizeof(*mai_cfg), &default_cfg, config_loaded);
+    mai_cfg = (mai_cfg_t *)save_alloc(sizeof(*mai_cfg), &default_cfg,
+                                      config_migrate, config_validate);
 }
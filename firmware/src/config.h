@@ -43,25 +43,64 @@ typedef struct __attribute__((packed)) {
     struct {
         uint8_t main_button_active_high : 1;
         uint8_t aux_button_active_high : 1;
-        uint8_t unused_bits : 6;
+        uint8_t vendor_port : 1;
+        uint8_t unused_bits : 5;
         uint8_t reserved[3];
     } tweak;
+    struct {
+        uint8_t map[14]; // LED for each IO4 GOUT bit, see GOUT_xxx
+    } gout;
+    struct {
+        uint8_t report : 1; // vendor touch report
+        uint8_t unused_bits : 7;
+        uint8_t keymap[34]; // HID keycode of each zone in NKRO touch mode
+    } touch_hid;
+    struct {
+        uint8_t profile; // USB_PROFILE_xxx, takes effect at next start
+    } usb;
+    struct {
+        uint8_t sync : 1; // start touch scan at a fixed phase of USB SOF
+        uint8_t unused_bits : 7;
+        uint16_t offset; // frame start after SOF, in us
+    } sof;
+    struct {
+        uint8_t catchup; // late scans run back to back after a stall, 0 skips
+        uint16_t period; // touch and HID scan period in us
+    } scan;
+    struct {
+        uint8_t profile; // CLOCK_xxx, takes effect at next start
+    } clock;
     uint8_t reserved[8];
 } mai_cfg_t;
 
+/* GOUT map: 0..7 main buttons, 8..10 cab body, ext, side */
+#define GOUT_LED_NONE 0xff
+#define GOUT_LED_CAB 8
+
+#define SCAN_CATCHUP_MAX 10
+#define SCAN_PERIOD_MIN 250
+#define SCAN_PERIOD_MAX 2000
+
 typedef struct {
     uint16_t fps[2];
     bool key_stuck;
     struct {
-        bool touch;
-        bool led;
-    } debug;
+        uint32_t usb_init_us; // all since power up
+        uint32_t ready_us;
+        uint32_t mount_us;
+        uint8_t profile; // USB profile in use
+    } boot;
 } mai_runtime_t;
 
 extern mai_cfg_t *mai_cfg;
 extern mai_runtime_t mai_runtime;
 
+/* Bump when old data needs config_migrate() to convert it, including new
+   fields taken out of reserved whose default isn't 0 */
+#define CONFIG_VERSION 1
+
 void config_init();
+void config_validate(); // Reset invalid parts to default
 void config_changed(); // Notify the config has changed
 void config_factory_reset(); // Reset the config to factory default
 
@@ -0,0 +1,253 @@
+/*
+ * Mai Pico Light Effects
+ * WHowe <github.com/whowechina>
+ *
+ * Attract mode effects on the 8 button lights, driven by touch and buttons.
+ * Everything here runs on core1 at the LED frame rate.
+ */
+
+#include "effect.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+#include "rgb.h"
+#include "prof.h"
+
+#define EFFECT_INTERVAL_US 4000 // same as LED frame
+#define RIPPLE_MAX 8
+#define RIPPLE_SPEED_US 60000 // time to travel one button
+#define RIPPLE_LIFE_US 400000
+#define GLOW_RAMP_US 500000
+
+/* Seqlock, core0 writes and never waits, core1 retries on a torn read */
+static struct {
+    volatile uint32_t seq;
+    uint64_t touch;
+    uint16_t buttons;
+} input;
+
+static uint32_t palette_dim[256];
+static uint32_t palette_lit[256];
+
+static struct {
+    uint32_t now;
+    uint16_t loop;
+    uint8_t sectors; // A/B/D/E zones folded into 8 sectors
+    uint8_t just_touched;
+    uint16_t buttons;
+    uint32_t canvas[8];
+} frame;
+
+static struct {
+    bool active;
+    uint8_t sector;
+    uint32_t start;
+} ripples[RIPPLE_MAX];
+static int ripple_pos = 0;
+
+static uint32_t press_time[8];
+
+void effect_input(uint64_t touch, uint16_t buttons)
+{
+    input.seq++;
+    __dmb();
+    input.touch = touch;
+    input.buttons = buttons;
+    __dmb();
+    input.seq++;
+}
+
+static void read_input(uint64_t *touch, uint16_t *buttons)
+{
+    uint32_t seq;
+    do {
+        seq = input.seq;
+        __dmb();
+        *touch = input.touch;
+        *buttons = input.buttons;
+        __dmb();
+    } while ((seq & 1) || (seq != input.seq));
+}
+
+static inline uint32_t scale(uint32_t color, uint8_t level)
+{
+    uint32_t r = ((color >> 16) & 0xff) * level >> 8;
+    uint32_t g = ((color >> 8) & 0xff) * level >> 8;
+    uint32_t b = (color & 0xff) * level >> 8;
+    return r << 16 | g << 8 | b;
+}
+
+static inline uint32_t add(uint32_t a, uint32_t b)
+{
+    uint32_t result = 0;
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t c = ((a >> shift) & 0xff) + ((b >> shift) & 0xff);
+        result |= (c > 0xff ? 0xff : c) << shift;
+    }
+    return result;
+}
+
+static inline uint8_t hue_of(int button)
+{
+    return (button * 256 + frame.loop) / 8;
+}
+
+static void effect_base()
+{
+    for (int i = 0; i < 8; i++) {
+        frame.canvas[i] = palette_dim[hue_of(i)];
+    }
+}
+
+static void effect_sector()
+{
+    for (int i = 0; i < 8; i++) {
+        if (frame.sectors & (1 << i)) {
+            frame.canvas[i] = add(frame.canvas[i], scale(palette_lit[hue_of(i)], 160));
+        }
+    }
+}
+
+static void effect_glow()
+{
+    for (int i = 0; i < 8; i++) {
+        if (!(frame.buttons & (1 << i))) {
+            press_time[i] = frame.now;
+            continue;
+        }
+        uint32_t held = frame.now - press_time[i];
+        uint8_t level = held >= GLOW_RAMP_US ? 255 : 64 + held * 191 / GLOW_RAMP_US;
+        frame.canvas[i] = add(frame.canvas[i], scale(palette_lit[hue_of(i)], level));
+    }
+}
+
+static void effect_ripple()
+{
+    for (int i = 0; i < 8; i++) {
+        if (frame.just_touched & (1 << i)) {
+            ripples[ripple_pos].active = true;
+            ripples[ripple_pos].sector = i;
+            ripples[ripple_pos].start = frame.now;
+            ripple_pos = (ripple_pos + 1) % RIPPLE_MAX;
+        }
+    }
+
+    for (int r = 0; r < RIPPLE_MAX; r++) {
+        if (!ripples[r].active) {
+            continue;
+        }
+        uint32_t age = frame.now - ripples[r].start;
+        if (age >= RIPPLE_LIFE_US) {
+            ripples[r].active = false;
+            continue;
+        }
+
+        /* front position in 1/256 button, fading out over its life */
+        int front = age * 256 / RIPPLE_SPEED_US;
+        int fade = 255 - age * 255 / RIPPLE_LIFE_US;
+        for (int i = 0; i < 8; i++) {
+            int dist = (i - ripples[r].sector + 8) % 8;
+            if (dist > 4) {
+                dist = 8 - dist;
+            }
+            int gap = abs(dist * 256 - front);
+            if (gap < 256) {
+                uint8_t level = (255 - gap) * fade >> 8;
+                frame.canvas[i] = add(frame.canvas[i], gray32(level, false));
+            }
+        }
+    }
+}
+
+static const struct {
+    const char *name;
+    void (*run)();
+} effects[] = {
+    { "base", effect_base },
+    { "sector", effect_sector },
+    { "glow", effect_glow },
+    { "ripple", effect_ripple },
+};
+
+static struct {
+    uint32_t last;
+    uint32_t peak;
+} cycles[count_of(effects)];
+
+void effect_init()
+{
+    for (int i = 0; i < 256; i++) {
+        palette_dim[i] = rgb32_from_hsv(i, 240, 20);
+        palette_lit[i] = rgb32_from_hsv(i, 64, 255);
+    }
+}
+
+void effect_update()
+{
+    static uint32_t last = 0;
+    uint32_t now = time_us_32();
+    if (now - last < EFFECT_INTERVAL_US) {
+        return;
+    }
+    last = now;
+
+    uint64_t touch;
+    uint16_t buttons;
+    read_input(&touch, &buttons);
+
+    uint8_t sectors = (touch | (touch >> 8) | (touch >> 18) | (touch >> 26)) & 0xff;
+    frame.just_touched = sectors & ~frame.sectors;
+    frame.sectors = sectors;
+    frame.buttons = buttons;
+    frame.now = now;
+    frame.loop += EFFECT_INTERVAL_US / 1000; // rainbow moves as it did at 1kHz
+
+    for (int i = 0; i < count_of(effects); i++) {
+        uint32_t start = prof_cycles();
+        effects[i].run();
+        cycles[i].last = prof_cycles_since(start);
+        if (cycles[i].last > cycles[i].peak) {
+            cycles[i].peak = cycles[i].last;
+        }
+    }
+
+    for (int i = 0; i < 8; i++) {
+        rgb_set_button(i, frame.canvas[i], 0);
+    }
+}
+
+int effect_num()
+{
+    return count_of(effects);
+}
+
+const char *effect_name(int id)
+{
+    if ((id < 0) || (id >= count_of(effects))) {
+        return "";
+    }
+    return effects[id].name;
+}
+
+void effect_cycles(int id, uint32_t *last, uint32_t *peak)
+{
+    if ((id < 0) || (id >= count_of(effects))) {
+        *last = 0;
+        *peak = 0;
+        return;
+    }
+    *last = cycles[id].last;
+    *peak = cycles[id].peak;
+}
+
+void effect_reset_stat()
+{
+    memset(cycles, 0, sizeof(cycles));
+}
@@ -0,0 +1,23 @@
+/*
+ * Mai Pico Light Effects
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef EFFECT_H
+#define EFFECT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* core0 publishes input, effects run on core1 */
+void effect_input(uint64_t touch, uint16_t buttons);
+
+void effect_init();
+void effect_update();
+
+int effect_num();
+const char *effect_name(int id);
+void effect_cycles(int id, uint32_t *last, uint32_t *peak);
+void effect_reset_stat();
+
+#endif
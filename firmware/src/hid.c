@@ -6,8 +6,14 @@
 #include "tusb.h"
 #include "usb_descriptors.h"
 #include "button.h"
+#include "touch.h"
 #include "config.h"
+#include "rgb.h"
 #include "hid.h"
+#include "trace.h"
+#include "hot.h"
+
+#define GOUT_TIMEOUT_SEC 300
 
 struct __attribute__((packed)) {
     uint16_t adcs[8];
@@ -24,7 +30,12 @@ struct __attribute__((packed)) {
     uint8_t keymap[15];
 } hid_nkro, sent_hid_nkro;
 
-static uint16_t native_to_io4(uint16_t button)
+struct __attribute__((packed)) {
+    uint64_t touch;
+    uint32_t time_us;
+} hid_touch, sent_hid_touch;
+
+static uint16_t HOT(native_to_io4)(uint16_t button)
 {
     static const int target_pos[] = { 2, 3, 0, 15, 14, 13, 12, 11, 9, 6, 1 };
     uint16_t io4btn = 0;
@@ -39,7 +50,7 @@ static uint16_t native_to_io4(uint16_t button)
     return io4btn;
 }
 
-static void gen_io4_report()
+static void HOT(gen_io4_report)()
 {
     static uint16_t last_buttons = 0;
     uint16_t buttons = button_read();
@@ -57,48 +68,209 @@ static void gen_io4_report()
 const char keymap_p1[] = BUTTON_NKRO_MAP_P1;
 const char keymap_p2[] = BUTTON_NKRO_MAP_P2;
 
-static void gen_nkro_report()
+static inline void nkro_press(uint8_t code)
+{
+    hid_nkro.keymap[code / 8] |= (1 << (code % 8));
+}
+
+static void HOT(gen_nkro_report)()
 {
+    memset(hid_nkro.keymap, 0, sizeof(hid_nkro.keymap));
+
     uint16_t buttons = button_read();
     const char *keymap = (mai_cfg->hid.nkro == 2) ? keymap_p2 : keymap_p1;
     for (int i = 0; i < button_num(); i++) {
-        uint8_t code = keymap[i];
-        uint8_t byte = code / 8;
-        uint8_t bit = code % 8;
         if (buttons & (1 << i)) {
-            hid_nkro.keymap[byte] |= (1 << bit);
-        } else {
-            hid_nkro.keymap[byte] &= ~(1 << bit);
+            nkro_press(keymap[i]);
+        }
+    }
+
+    if (mai_cfg->hid.nkro == 3) {
+        uint64_t touch = touch_touchmap();
+        for (int i = 0; i < sizeof(mai_cfg->touch_hid.keymap); i++) {
+            uint8_t code = mai_cfg->touch_hid.keymap[i];
+            if ((touch & (1ULL << i)) && code) {
+                nkro_press(code);
+            }
+        }
+    }
+}
+
+static void HOT(gen_touch_report)()
+{
+    hid_touch.touch = touch_touchmap();
+    hid_touch.time_us = touch_sample_time();
+}
+
+static bool HOT(io4_enabled)()
+{
+    return mai_cfg->hid.io4;
+}
+
+static bool HOT(nkro_enabled)()
+{
+    return mai_cfg->hid.nkro && !mai_runtime.key_stuck;
+}
+
+static bool HOT(touch_enabled)()
+{
+    return mai_cfg->touch_hid.report;
+}
+
+/* One slot per HID report. A report is marked pending when its content
+   changes (or the periodic IO4 report is due) and goes out as soon as its
+   endpoint is free, either right away or from the completion of the
+   previous report. The latest state is sent, so a busy endpoint coalesces
+   edges instead of queueing stale reports. The touch report changes with
+   every sample as it carries the sample time, so it runs at the scan rate.
+   Which HID instance a slot goes to depends on the USB profile. */
+enum { HID_SLOT_IO4, HID_SLOT_NKRO, HID_SLOT_TOUCH, HID_SLOT_NUM };
+
+static struct {
+    enum usb_port port;
+    uint8_t report_id;
+    const void *report;
+    void *sent;
+    uint16_t size;
+    bool (*enabled)();
+    void (*generate)();
+    bool pending;
+} slots[HID_SLOT_NUM] = {
+    { USB_HID_IO4, REPORT_ID_JOYSTICK, &hid_io4, &sent_hid_io4, sizeof(hid_io4),
+      io4_enabled, gen_io4_report },
+    { USB_HID_NKRO, 0, &hid_nkro, &sent_hid_nkro, sizeof(hid_nkro),
+      nkro_enabled, gen_nkro_report },
+    { USB_HID_TOUCH, 0, &hid_touch, &sent_hid_touch, sizeof(hid_touch),
+      touch_enabled, gen_touch_report },
+};
+
+static uint64_t next_periodic_report = 0;
+
+static bool HOT(slot_active)(int slot)
+{
+    return (usb_instance(slots[slot].port) >= 0) && slots[slot].enabled();
+}
+
+static int HOT(slot_of_instance)(uint8_t instance)
+{
+    int port = usb_hid_port(instance);
+    for (int i = 0; i < HID_SLOT_NUM; i++) {
+        if (slots[i].port == port) {
+            return i;
         }
     }
+    return -1;
 }
 
-void hid_update()
+static void HOT(hid_flush)(int slot)
 {
-    if (!tud_hid_ready()) {
+    if ((slot < 0) || !slots[slot].pending) {
         return;
     }
 
-    if (mai_cfg->hid.io4) {
-        gen_io4_report();
-        static uint64_t next_periodic_report = 0;
-        uint64_t now = time_us_64();
-        /* Somehow edge-triggering doesn't pass self-test, so periodic report
-           is also there, with a lower rate that doesn't crowd the bus. */
-        if ((memcmp(&hid_io4, &sent_hid_io4, sizeof(hid_io4)) != 0) ||
-            (now > next_periodic_report)) {
-            next_periodic_report = now + 4000; // 250Hz periodic report
-            if (tud_hid_report(REPORT_ID_JOYSTICK, &hid_io4, sizeof(hid_io4))) {
-                sent_hid_io4 = hid_io4;
-            }
+    if (!slot_active(slot)) {
+        slots[slot].pending = false;
+        return;
+    }
+
+    uint8_t instance = usb_instance(slots[slot].port);
+    if (!tud_hid_n_ready(instance)) {
+        return;
+    }
+
+    if (tud_hid_n_report(instance, slots[slot].report_id, slots[slot].report, slots[slot].size)) {
+        memcpy(slots[slot].sent, slots[slot].report, slots[slot].size);
+        slots[slot].pending = false;
+        if (slot == HID_SLOT_IO4) {
+            /* 250Hz at the default 1ms scan, scales with the scan rate */
+            next_periodic_report = time_us_64() + mai_cfg->scan.period * 4;
         }
     }
+}
+
+void HOT(tud_hid_report_complete_cb)(uint8_t instance, uint8_t const *report, uint16_t len)
+{
+    hid_flush(slot_of_instance(instance));
+}
+
+/* GET_REPORT gets the latest generated report, no blocking, no printing.
+   The stack puts the report ID ahead of buffer by itself. */
+uint16_t tud_hid_get_report_cb(uint8_t itf, uint8_t report_id,
+                               hid_report_type_t report_type, uint8_t *buffer,
+                               uint16_t reqlen)
+{
+    int slot = slot_of_instance(itf);
+    if ((slot < 0) || (report_type != HID_REPORT_TYPE_INPUT) ||
+        (report_id != slots[slot].report_id) || !slot_active(slot)) {
+        return 0;
+    }
+
+    uint16_t len = slots[slot].size < reqlen ? slots[slot].size : reqlen;
+    memcpy(buffer, slots[slot].report, len);
+    return len;
+}
+
+void HOT(hid_update)()
+{
+    for (int i = 0; i < HID_SLOT_NUM; i++) {
+        if (!slot_active(i)) {
+            continue;
+        }
+        slots[i].generate();
+        if (memcmp(slots[i].report, slots[i].sent, slots[i].size) != 0) {
+            slots[i].pending = true;
+        }
+    }
+
+    /* Somehow edge-triggering doesn't pass self-test, so periodic report
+       is also there, with a lower rate that doesn't crowd the bus. */
+    if (slot_active(HID_SLOT_IO4) && (time_us_64() > next_periodic_report)) {
+        slots[HID_SLOT_IO4].pending = true;
+    }
+
+    for (int i = 0; i < HID_SLOT_NUM; i++) {
+        hid_flush(i);
+    }
+}
+
+static struct {
+    uint32_t bits;
+    uint64_t last_time;
+} gout;
+
+bool hid_gout_active()
+{
+    if (gout.last_time == 0) {
+        return false;
+    }
+
+    return time_us_64() < gout.last_time + GOUT_TIMEOUT_SEC * 1000000;
+}
 
-    if (mai_cfg->hid.nkro && !mai_runtime.key_stuck) {
-        gen_nkro_report();
-        if ((memcmp(&hid_nkro, &sent_hid_nkro, sizeof(hid_nkro)) != 0) &&
-            tud_hid_n_report(1, 0, &hid_nkro, sizeof(hid_nkro))) {
-            sent_hid_nkro = hid_nkro;
+static void gout_led(uint8_t led, bool on)
+{
+    if (led < GOUT_LED_CAB) {
+        rgb_set_button(led, on ? mai_cfg->color.key_on : mai_cfg->color.key_off, 0);
+    } else if (led != GOUT_LED_NONE) {
+        rgb_set_cab(led - GOUT_LED_CAB, on ? gray32(255, false) : 0);
+    }
+}
+
+/* GOUT bits come MSB first, only changed bits go to the LEDs, except when
+   taking the lights over from idle effects. IO4 general outputs are only
+   on or off, there are no values to take, the colours come from config. */
+static void set_gout(const uint8_t *payload)
+{
+    uint32_t bits = payload[0] << 24 | payload[1] << 16 | payload[2] << 8 | payload[3];
+    uint32_t changed = hid_gout_active() ? bits ^ gout.bits : ~0UL;
+
+    gout.bits = bits;
+    gout.last_time = time_us_64();
+
+    for (int i = 0; i < count_of(mai_cfg->gout.map); i++) {
+        uint32_t mask = 1UL << (31 - i);
+        if (changed & mask) {
+            gout_led(mai_cfg->gout.map[i], bits & mask);
         }
     }
 }
@@ -113,6 +285,10 @@ void hid_proc(const uint8_t *data, uint8_t len)
 {
     hid_output_t *output = (hid_output_t *)data;
     if (output->report_id == REPORT_ID_OUTPUT) {
+        uint32_t raw;
+        memcpy(&raw, output->payload, sizeof(raw));
+        trace(TRACE_HID_CMD, output->cmd, raw);
+
         switch (output->cmd) {
             case 0x01: // Set Timeout
             case 0x02: // Set Sampling Count
@@ -124,10 +300,11 @@ void hid_proc(const uint8_t *data, uint8_t len)
                 hid_io4.system_status = 0x00;
                 break;
             case 0x04: // Set General Output
+                set_gout(output->payload);
+                break;
             case 0x41: // I don't know what this is
                 break;
-            default:
-                printf("USB unknown cmd: %d\n", output->cmd);
+            default: // unknown, only traced
                 break;
         }
     }
@@ -8,5 +8,6 @@
 
 void hid_update();
 void hid_proc(const uint8_t *data, uint8_t len);
+bool hid_gout_active();
 
 #endif
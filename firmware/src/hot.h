@@ -0,0 +1,24 @@
+/*
+ * Hot Path Placement
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef HOT_H
+#define HOT_H
+
+#include "pico/platform.h"
+
+/* Code on the per-scan path, interrupt handlers and the LED driver go to
+   SRAM with the HOT_PATH_IN_SRAM build option, so XIP cache misses and
+   flash programming can't stall them. */
+#ifndef HOT_PATH_IN_SRAM
+#define HOT_PATH_IN_SRAM 0
+#endif
+
+#if HOT_PATH_IN_SRAM
+#define HOT(func) __not_in_flash_func(func)
+#else
+#define HOT(func) func
+#endif
+
+#endif
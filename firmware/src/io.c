@@ -5,13 +5,15 @@
 #include "tusb.h"
 #include "usb_descriptors.h"
 
+#include "config.h"
 #include "touch.h"
 #include "rgb.h"
+#include "sof.h"
+#include "trace.h"
+#include "hot.h"
 
 #define IO_TIMEOUT_SEC 300
 
-#define DEBUG(x, ...) { if (mai_runtime.debug.x) { printf(__VA_ARGS__); } }
-
 static struct {
     bool stat;
     uint64_t last_io_time;
@@ -45,6 +47,10 @@ typedef union {
         uint8_t data;
     } eeprom;
     uint8_t rgb[11][3];
+    struct {
+        uint8_t flags;
+        uint8_t rgb[11][3]; // 8 buttons then body, ext, side
+    } frame;
 } led_data_t;
 
 typedef union {
@@ -65,34 +71,48 @@ typedef union {
 #define SYNC 0xE0
 #define ESCAPE 0xD0
 
+/* Extension: whole frame in one command, not in the original 15070 */
+#define LED_CMD_FRAME 0x80
+#define LED_FRAME_NO_ACK 0x01
+
+typedef union {
+    uint8_t raw[48];
+    struct {
+        struct {
+            uint8_t dst;
+            uint8_t src;
+            uint8_t len;
+            uint8_t cmd;
+        } hdr;
+        led_data_t led;
+    };
+} led_frame_t;
+
 typedef struct {
     int interface;
     bool connected;
     bool in_cmd;
     bool is_touch;
     bool escape;
-    union {
-        uint8_t buf[48];
-        struct {
-            struct {
-                uint8_t dst;
-                uint8_t src;
-                uint8_t len;
-                uint8_t cmd;
-            } hdr;
-            led_data_t led;
-        };
-    };
+    led_frame_t frame; /* for frames split across packets or escaped */
     uint8_t len;
     uint8_t checksum;
 } cdc_t;
 
 static cdc_t cdc[2] = {
-    { .interface = 1 },
-    { .interface = 2 },
+    { .interface = -1 },
+    { .interface = -1 },
 };
 
-static void touch_cmd(cdc_t *cdc)
+static void HOT(touch_reply)(cdc_t *cdc, char cmd)
+{
+    const uint8_t *buf = cdc->frame.raw;
+    uint8_t reply[6] = { '(', buf[0], buf[1], cmd, buf[3], ')' }; // L/R, sensor, ratio
+    tud_cdc_n_write(cdc->interface, reply, sizeof(reply));
+    tud_cdc_n_write_flush(cdc->interface);
+}
+
+static void HOT(touch_cmd)(cdc_t *cdc)
 {
     cdc->in_cmd = false;
     if (cdc->len != 4) {
@@ -103,127 +123,153 @@ static void touch_cmd(cdc_t *cdc)
 
     ctx.touch_interface = cdc->interface;
 
-    switch (cdc->buf[2]) {
-        case 'E':
-            DEBUG(touch, "Touch RSET\n");
+    uint32_t raw;
+    memcpy(&raw, cdc->frame.raw, sizeof(raw));
+    trace(TRACE_TOUCH_CMD, cdc->frame.raw[2], raw);
+
+    switch (cdc->frame.raw[2]) {
+        case 'E': // RSET
             break;
-        case 'L':
-            DEBUG(touch, "Touch HALT\n");
+        case 'L': // HALT
             ctx.stat = false;
             break;
-        case 'A':
-            DEBUG(touch, "Touch STAT\n");
+        case 'A': // STAT
             ctx.stat = true;
             break;
-        case 'r':
-            DEBUG(touch, "Touch Ratio\n");
-            tud_cdc_n_write_char(cdc->interface, '(');
-            tud_cdc_n_write_char(cdc->interface, cdc->buf[0]); //L,R
-            tud_cdc_n_write_char(cdc->interface, cdc->buf[1]); //sensor
-            tud_cdc_n_write_char(cdc->interface, 'r');
-            tud_cdc_n_write_char(cdc->interface, cdc->buf[3]); // Ratio
-            tud_cdc_n_write_char(cdc->interface, ')');
-            tud_cdc_n_write_flush(cdc->interface);
+        case 'r': // Ratio
+            touch_reply(cdc, 'r');
             break;
-        case 'k':
-            DEBUG(touch, "Touch Sense\n");
-            tud_cdc_n_write_char(cdc->interface, '(');
-            tud_cdc_n_write_char(cdc->interface, cdc->buf[0]); //L,R
-            tud_cdc_n_write_char(cdc->interface, cdc->buf[1]); //sensor
-            tud_cdc_n_write_char(cdc->interface, 'k');
-            tud_cdc_n_write_char(cdc->interface, cdc->buf[3]); // Ratio
-            tud_cdc_n_write_char(cdc->interface, ')');
-            tud_cdc_n_write_flush(cdc->interface);
+        case 'k': // Sense
+            touch_reply(cdc, 'k');
             break;
         default:
-            DEBUG(touch, "Touch CMD Unknown: %*s -> ", 4, cdc->buf);
             return;
     }
 }
 
-static void led_write(cdc_t *cdc, led_resp_t *resp)
+static inline uint8_t *escape_byte(uint8_t *out, uint8_t c)
+{
+    if ((c == SYNC) || (c == ESCAPE)) {
+        *out++ = ESCAPE;
+        *out++ = c - 1;
+    } else {
+        *out++ = c;
+    }
+    return out;
+}
+
+/* Escaped into one buffer and handed over in one write, flush is left
+   to update_itf() so replies to a whole packet go out together. */
+static void HOT(led_write)(cdc_t *cdc, led_resp_t *resp)
 {
-    tud_cdc_n_write_char(cdc->interface, SYNC); // SYNC
+    uint8_t buf[2 + sizeof(resp->raw) * 2];
+    uint8_t *out = buf;
 
+    *out++ = SYNC;
     uint8_t checksum = 0;
     for (int i = 0; i < resp->hdr.len + 3; i++) {
-        uint8_t c = resp->raw[i];
-        checksum += c;
-        if (c == SYNC || c == ESCAPE) {
-            tud_cdc_n_write_char(cdc->interface, ESCAPE);
-            tud_cdc_n_write_char(cdc->interface, c - 1);
-        } else {
-            tud_cdc_n_write_char(cdc->interface, c);
-        }
+        checksum += resp->raw[i];
+        out = escape_byte(out, resp->raw[i]);
     }
-    tud_cdc_n_write_char(cdc->interface, checksum);
-    tud_cdc_n_write_flush(cdc->interface);
+    out = escape_byte(out, checksum);
+
+    tud_cdc_n_write(cdc->interface, buf, out - buf);
 }
 
-static led_resp_t *led_init_resp(cdc_t *cdc, uint8_t payload_len)
+static led_resp_t *HOT(led_init_resp)(const led_frame_t *frame, uint8_t payload_len)
 {
     static led_resp_t resp;
-    resp.hdr.dst = cdc->hdr.src;
-    resp.hdr.src = cdc->hdr.dst;
+    resp.hdr.dst = frame->hdr.src;
+    resp.hdr.src = frame->hdr.dst;
     resp.hdr.len = payload_len + 3;
     resp.hdr.status = 1;
-    resp.hdr.cmd = cdc->hdr.cmd;
+    resp.hdr.cmd = frame->hdr.cmd;
     resp.hdr.report = 1;
     return &resp;
 }
 
-static void led_ack_ok(cdc_t *cdc)
+static void HOT(led_ack_ok)(cdc_t *cdc, const led_frame_t *frame)
 {
-    led_resp_t *resp = led_init_resp(cdc, 0);
+    led_resp_t *resp = led_init_resp(frame, 0);
     led_write(cdc, resp);
 }
 
 static uint8_t led_ram[256];
 
-static void led_set_eeprom(cdc_t *cdc)
+static void led_set_eeprom(cdc_t *cdc, const led_frame_t *frame)
 {
-    led_ram[cdc->led.eeprom.addr] = cdc->led.eeprom.data;
-    led_ack_ok(cdc);
+    led_ram[frame->led.eeprom.addr] = frame->led.eeprom.data;
+    led_ack_ok(cdc, frame);
 }
 
-static void led_get_eeprom(cdc_t *cdc)
+static void led_get_eeprom(cdc_t *cdc, const led_frame_t *frame)
 {
-    led_resp_t *resp = led_init_resp(cdc, 1);
-    resp->payload[0] = led_ram[cdc->led.eeprom.addr];
+    led_resp_t *resp = led_init_resp(frame, 1);
+    resp->payload[0] = led_ram[frame->led.eeprom.addr];
     led_write(cdc, resp);
 }
 
-static void led_board_info(cdc_t *cdc)
+static void led_board_info(cdc_t *cdc, const led_frame_t *frame)
 {
-    led_resp_t *resp = led_init_resp(cdc, 10);
+    led_resp_t *resp = led_init_resp(frame, 10);
     memcpy(resp->payload, "15070-04\xff\x90", 10);
     led_write(cdc, resp);
 }
 
-static void led_board_status(cdc_t *cdc)
+static void led_board_status(cdc_t *cdc, const led_frame_t *frame)
 {
-    led_resp_t *resp = led_init_resp(cdc, 4);
+    led_resp_t *resp = led_init_resp(frame, 4);
     memcpy(resp->payload, "\x00\x00\x00\x00", 4);
     led_write(cdc, resp);
 }
 
-static void led_proto_ver(cdc_t *cdc)
+static void led_proto_ver(cdc_t *cdc, const led_frame_t *frame)
 {
-    led_resp_t *resp = led_init_resp(cdc, 3);
+    led_resp_t *resp = led_init_resp(frame, 3);
     memcpy(resp->payload, "\x01\x00\x00", 3);
     led_write(cdc, resp);
 }
 
-static void led_cmd(cdc_t *cdc)
+static bool HOT(led_set_frame)(const led_frame_t *frame)
+{
+    const led_data_t *led = &frame->led;
+    if (frame->hdr.len < 1 + sizeof(led->frame)) {
+        trace(TRACE_LED_SHORT, frame->hdr.len, 0);
+        return false;
+    }
+
+    uint32_t button[8];
+    uint32_t cab[3];
+    for (int i = 0; i < 8; i++) {
+        const uint8_t *c = led->frame.rgb[i];
+        button[i] = rgb32(c[0], c[1], c[2], false);
+    }
+    for (int i = 0; i < 3; i++) {
+        const uint8_t *c = led->frame.rgb[8 + i];
+        cab[i] = rgb32(c[0], c[1], c[2], false);
+    }
+    rgb_set_frame(button, cab);
+    return !(led->frame.flags & LED_FRAME_NO_ACK);
+}
+
+static void HOT(led_cmd)(cdc_t *cdc, const led_frame_t *frame)
 {
     cdc->in_cmd = false;
     cdc->len = 0;
     ctx.last_io_time = time_us_64();
+    sof_rx_handled(SOF_RX_LED);
+
+    /* len counts cmd, a short frame run in place has no data of its own
+       past the checksum */
+    uint32_t raw = 0;
+    int data_len = frame->hdr.len - 1;
+    memcpy(&raw, frame->led.raw, data_len < 0 ? 0 : (data_len < 4 ? data_len : 4));
+    trace(TRACE_LED_CMD, frame->hdr.cmd, raw);
 
+    const led_data_t *led = &frame->led;
     uint32_t color;
-    switch (cdc->hdr.cmd) {
-        case 0x10:
-            DEBUG(led, "LED RSET\n");
+    switch (frame->hdr.cmd) {
+        case 0x10: // reset
             for (int i = 0; i < 8; i++) {
                 rgb_set_button(i, 0, 0);
             }
@@ -231,135 +277,205 @@ static void led_cmd(cdc_t *cdc)
                 rgb_set_cab(i, 0);
             }
             break;
-        case 0x31:
-            color = rgb32(cdc->led.r, cdc->led.g, cdc->led.b, false);
-            DEBUG(led, "LED %d:1 %06lx\n", cdc->led.index, color);
-            rgb_set_button(cdc->led.index, color, 0);          
+        case 0x31: // one button
+            color = rgb32(led->r, led->g, led->b, false);
+            rgb_set_button(led->index, color, 0);
             break;
-        case 0x32:
-            color = rgb32(cdc->led.mr, cdc->led.mg, cdc->led.mb, false);
-            DEBUG(led, "LED %d:%d %06lx\n", cdc->led.start, cdc->led.len, color);
-            for (int i = 0; i < cdc->led.len; i++) {
-                rgb_set_button(i + cdc->led.start, color, 0);
+        case 0x32: // range of buttons
+            color = rgb32(led->mr, led->mg, led->mb, false);
+            for (int i = 0; i < led->len; i++) {
+                rgb_set_button(i + led->start, color, 0);
             }
             break;
-        case 0x33:
-            color = rgb32(cdc->led.mr, cdc->led.mg, cdc->led.mb, false);
-            DEBUG(led, "LED %d:%d %06lx %d\n", cdc->led.start, cdc->led.len, color, cdc->led.speed);
-            for (int i = 0; i < cdc->led.len; i++) {
-                rgb_set_button(i + cdc->led.start, color, cdc->led.speed);
+        case 0x33: // range of buttons, fading
+            color = rgb32(led->mr, led->mg, led->mb, false);
+            for (int i = 0; i < led->len; i++) {
+                rgb_set_button(i + led->start, color, led->speed);
             }
             break;
-        case 0x39:
-            DEBUG(led, "LED Fet\n");
-            rgb_set_cab(0, gray32(cdc->led.body, false));
-            rgb_set_cab(1, gray32(cdc->led.ext, false));
-            rgb_set_cab(2, gray32(cdc->led.side, false));
+        case 0x39: // cabinet FETs
+            rgb_set_cab(0, gray32(led->body, false));
+            rgb_set_cab(1, gray32(led->ext, false));
+            rgb_set_cab(2, gray32(led->side, false));
+            break;
+        case LED_CMD_FRAME:
+            if (!led_set_frame(frame)) {
+                return;
+            }
             break;
 
         case 0x7b:
-            led_set_eeprom(cdc);
+            led_set_eeprom(cdc, frame);
             return;
         case 0x7c:
-            led_get_eeprom(cdc);
+            led_get_eeprom(cdc, frame);
             return;
         case 0xf0:
-            led_board_info(cdc);
+            led_board_info(cdc, frame);
             return;
         case 0xf1:
-            led_board_status(cdc);
+            led_board_status(cdc, frame);
             return;
         case 0xf3:
-            led_proto_ver(cdc);
+            led_proto_ver(cdc, frame);
             return;
 
-        default:
-            DEBUG(led, "Ignoring LED Cmd %02x\n", cdc->hdr.cmd);
+        default: // ignored
             break;
     }
 
-    led_ack_ok(cdc);
+    led_ack_ok(cdc, frame);
 }
 
-static inline void assemble_cmd(cdc_t *cdc, uint8_t c)
+static void HOT(touch_feed)(cdc_t *cdc, uint8_t c)
 {
-    if (c == SYNC) {
+    if (c == '{') {
         cdc->len = 0;
         cdc->in_cmd = true;
-        cdc->is_touch = false;
-        cdc->escape = false;
-        cdc->checksum = 0;
+        cdc->is_touch = true;
         return;
     }
 
-    if ((!cdc->in_cmd || cdc->is_touch) && (c == '{')) {
-        cdc->len = 0;
-        cdc->in_cmd = true;
-        cdc->is_touch = true;
+    if (!cdc->in_cmd) {
         return;
     }
 
-    if (cdc->is_touch) {
-        // Touch cmd
-        if (c == '}') {
-            touch_cmd(cdc);
-        } else if (cdc->len < sizeof(cdc->buf)) {
-            cdc->buf[cdc->len] = c;
-            cdc->len++;
-        }
-        return;
+    if (c == '}') {
+        touch_cmd(cdc);
+    } else if (cdc->len < sizeof(cdc->frame.raw)) {
+        cdc->frame.raw[cdc->len] = c;
+        cdc->len++;
     }
+}
 
-    // LED cmd
-    if (c == ESCAPE) {
-        cdc->escape = true;
-        return;
+static inline const uint8_t *next_special(const uint8_t *p, const uint8_t *end)
+{
+    while ((p < end) && (*p != SYNC) && (*p != ESCAPE)) {
+        p++;
+    }
+    return p;
+}
+
+/* A frame right after SYNC that sits entirely in the packet with nothing
+   to unescape is executed in place. Returns the bytes consumed, 0 if the
+   frame has to go through the assembling path. */
+static int HOT(led_frame_inplace)(cdc_t *cdc, const uint8_t *p, const uint8_t *end)
+{
+    const uint8_t *plain_end = next_special(p, end);
+    if (plain_end - p < 3) {
+        return 0;
     }
-    
-    if (cdc->escape) {
-        cdc->escape = false;
-        c++;
+
+    int size = p[2] + 3;
+    if ((size > sizeof(led_frame_t)) || (plain_end - p < size + 1)) {
+        return 0;
     }
 
-    if ((cdc->len == cdc->hdr.len + 3) && (cdc->checksum == c)) {
-        led_cmd(cdc);
-        return;
+    uint8_t checksum = 0;
+    for (int i = 0; i < size; i++) {
+        checksum += p[i];
     }
-    
-    if (cdc->len < sizeof(cdc->buf)) {
-        cdc->buf[cdc->len] = c;
+    if (checksum == p[size]) {
+        led_cmd(cdc, (const led_frame_t *)p);
+    } else {
+        cdc->in_cmd = false;
+    }
+    return size + 1;
+}
+
+static const uint8_t *HOT(led_assemble)(cdc_t *cdc, const uint8_t *p, const uint8_t *end)
+{
+    const uint8_t *plain_end = next_special(p, end);
+    while (p < plain_end) {
+        uint8_t c = *p++;
+        if (cdc->escape) {
+            cdc->escape = false;
+            c++;
+        }
+
+        if ((cdc->len >= 3) && (cdc->len == cdc->frame.hdr.len + 3)) {
+            if (cdc->checksum == c) {
+                led_cmd(cdc, &cdc->frame);
+            } else {
+                cdc->in_cmd = false;
+            }
+            return p;
+        }
+
+        if (cdc->len >= sizeof(cdc->frame.raw)) {
+            cdc->in_cmd = false;
+            return p;
+        }
+
+        cdc->frame.raw[cdc->len] = c;
         cdc->len++;
         cdc->checksum += c;
     }
+
+    if ((p < end) && (*p == ESCAPE)) {
+        cdc->escape = true;
+        p++;
+    }
+    return p;
+}
+
+static void HOT(parse_packet)(cdc_t *cdc, const uint8_t *p, const uint8_t *end)
+{
+    while (p < end) {
+        if (*p == SYNC) {
+            p++;
+            cdc->len = 0;
+            cdc->in_cmd = true;
+            cdc->is_touch = false;
+            cdc->escape = false;
+            cdc->checksum = 0;
+            p += led_frame_inplace(cdc, p, end);
+        } else if (cdc->in_cmd && !cdc->is_touch) {
+            p = led_assemble(cdc, p, end);
+        } else {
+            touch_feed(cdc, *p++);
+        }
+    }
 }
 
-static void update_itf(cdc_t *cdc)
+static void HOT(update_itf)(cdc_t *cdc)
 {
     cdc->connected = tud_cdc_n_connected(cdc->interface);
 
-    if (tud_cdc_n_available(cdc->interface)) {
-        uint8_t buf[48];
-        uint32_t count = tud_cdc_n_read(cdc->interface, buf, sizeof(buf));
-        for (int i = 0; i < count; i++) {
-            assemble_cmd(cdc, buf[i]);
+    uint32_t avail = tud_cdc_n_available(cdc->interface);
+    if (avail == 0) {
+        return;
+    }
+
+    /* a frame run in place is read as a led_frame_t, the tail keeps the
+       fields of a short one at the end of a packet inside the array */
+    static uint8_t packet[CFG_TUD_CDC_RX_BUFSIZE + sizeof(led_frame_t)];
+    while (avail > 0) {
+        uint32_t count = tud_cdc_n_read(cdc->interface, packet, CFG_TUD_CDC_RX_BUFSIZE);
+        if (count == 0) {
+            break;
         }
+        parse_packet(cdc, packet, packet + count);
+        avail = tud_cdc_n_available(cdc->interface);
     }
+    tud_cdc_n_write_flush(cdc->interface);
 }
 
-static void send_touch()
+static void HOT(send_touch)()
 {
     if ((ctx.touch_interface == 0) | (!ctx.stat)) {
         return;
     }
 
+    /* once per scan: half a period still lets through scans that come a
+       bit early (jitter, SOF phase moves), but not catch-up bursts */
     static uint64_t last_sent_time = 0;
     uint64_t now = time_us_64();
-    if (now - last_sent_time < 1000) {
+    if (now - last_sent_time < mai_cfg->scan.period / 2) {
         return;
     }
     last_sent_time = now;
 
-
     uint8_t report[9] = "(\0\0\0\0\0\0\0)";
     uint64_t touch = touch_touchmap();
     for (int i = 0; i < 7; i++) {
@@ -370,10 +486,24 @@ static void send_touch()
     tud_cdc_n_write_flush(ctx.touch_interface);
 }
 
-void io_update()
+void io_init()
+{
+    cdc[0].interface = usb_instance(USB_CDC_TOUCH);
+    cdc[1].interface = usb_instance(USB_CDC_LED);
+}
+
+void HOT(io_poll)()
+{
+    for (int i = 0; i < count_of(cdc); i++) {
+        if (cdc[i].interface >= 0) {
+            update_itf(&cdc[i]);
+        }
+    }
+}
+
+void HOT(io_update)()
 {
-    update_itf(cdc);
-    update_itf(cdc + 1);
+    io_poll();
     send_touch();
 }
 
@@ -6,7 +6,9 @@
 #ifndef IO_H_
 #define IO_H_
 
+void io_init();
+void io_poll(); // host commands only, safe to call any time
 void io_update();
 bool io_is_active();
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
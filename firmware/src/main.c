@@ -37,6 +37,13 @@
 #include "commands.h"
 #include "io.h"
 #include "hid.h"
+#include "effect.h"
+#include "vendor.h"
+#include "sof.h"
+#include "sched.h"
+#include "prof.h"
+#include "hot.h"
+#include "clock.h"
 
 static void button_lights_clear()
 {
@@ -45,66 +52,62 @@ static void button_lights_clear()
     }
 }
 
-static void button_lights_rainbow()
-{
-    static uint16_t loop = 0;
-    loop++;
-    uint16_t buttons = button_read();
-    for (int i = 0; i < 8; i++) {
-        uint8_t phase = (i * 256 + loop) / 8;
-        uint32_t color;
-        if (buttons & (1 << i)) {
-            color = rgb32_from_hsv(phase, 64, 255);
-        } else {
-            color = rgb32_from_hsv(phase, 240, 20);
-        }
-        rgb_set_button(i, color, 0);
-    }
-}
-
 static void run_lights()
 {
-    static bool was_rainbow = true;
-    bool go_rainbow = !io_is_active() && !aime_is_active();
-
-    if (go_rainbow) {
-        button_lights_rainbow();
-    } else if (was_rainbow) {
+    static bool was_effect = true;
+    bool go_effect = !io_is_active() && !hid_gout_active() && !aime_is_active();
+
+    /* GOUT sets every light it maps on its first report, which may
+       already be in, so it's left alone */
+    if (go_effect) {
+        effect_update();
+    } else if (was_effect && !hid_gout_active()) {
         button_lights_clear();
     }
 
-    was_rainbow = go_rainbow;
+    was_effect = go_effect;
 
     rgb_set_aime(aime_led_color());
 }
 
-const int aime_intf = 3;
+static int aime_intf = -1;
 static void cdc_aime_putc(uint8_t byte)
 {
+    if (aime_intf < 0) {
+        return;
+    }
     tud_cdc_n_write(aime_intf, &byte, 1);
     tud_cdc_n_write_flush(aime_intf);
 }
 
+static bool aime_pending()
+{
+    return (aime_intf >= 0) && tud_cdc_n_available(aime_intf);
+}
+
 static void aime_run()
 {
-    if (tud_cdc_n_available(aime_intf)) {
+    if (aime_pending()) {
         uint8_t buf[32];
         uint32_t count = tud_cdc_n_read(aime_intf, buf, sizeof(buf));
+        sof_rx_handled(SOF_RX_AIME);
+        uint32_t start = prof_cycles();
         for (int i = 0; i < count; i++) {
             aime_feed(buf[i]);
         }
+        prof_record(PROF_AIME, prof_cycles_since(start));
     }
 }
 
-static mutex_t core1_io_lock;
 static void core1_loop()
 {
+    multicore_lockout_victim_init(); // flash ops park core1 briefly
+    prof_init();
+    rgb_init();
+    effect_init();
     while (1) {
-        if (mutex_try_enter(&core1_io_lock, NULL)) {
-            run_lights();
-            rgb_update();
-            mutex_exit(&core1_io_lock);
-        }
+        PROF(PROF_LIGHTS, run_lights());
+        PROF(PROF_RGB, rgb_update());
         cli_fps_count(1);
         sleep_ms(1);
     }
@@ -132,62 +135,119 @@ static void runtime_ctrl()
     last_coin_button = coin_button;
 }
 
-static void main_frame()
+static int scan_task = -1;
+static uint64_t last_input_time = 0;
+static void HOT(scan_run)()
 {
-    static uint64_t next_frame = 0;
+    PROF(PROF_TOUCH, touch_update());
+    PROF(PROF_BUTTON, button_update());
+    PROF(PROF_HID, hid_update()); // edges of this scan go out now, not next frame
+    sof_mark_sampled();
+    effect_input(touch_touchmap(), button_read());
+    PROF(PROF_IO, io_update());
+
+    if (touch_touchmap() || button_read()) {
+        last_input_time = time_us_64();
+    }
 
-    sleep_until(next_frame);
-    next_frame += 1000;
+    cli_fps_count(0);
 
-    tud_task();
-    io_update();
+    /* rate changes from CLI or vendor port apply from the next scan */
+    sched_set_period(scan_task, mai_cfg->scan.period);
+    if (mai_cfg->sof.sync && sof_locked()) {
+        sched_next_at(scan_task, sof_next_start(mai_cfg->sof.offset,
+                                                mai_cfg->scan.period));
+    }
+}
 
-    cli_run();
+/* USB is serviced whenever the stack has an event, so LED, touch and
+   Aime commands don't wait for the next scan */
+static void HOT(usb_run)()
+{
+    PROF(PROF_TUD_TASK, tud_task());
+    PROF(PROF_IO_POLL, io_poll());
+}
 
-    touch_update();
-    button_update();
+static void cli_task()
+{
+    PROF(PROF_CLI, cli_run());
+}
+
+static void vendor_task()
+{
+    PROF(PROF_VENDOR, vendor_update());
+}
 
-    hid_update();
+#define IDLE_ERASE_US 3000000
 
-    cli_fps_count(0);
+static void save_task()
+{
+    PROF(PROF_SAVE, save_loop());
+
+    /* sector erase blacks out for tens of ms, only do it when nobody plays */
+    if (time_us_64() - last_input_time > IDLE_ERASE_US) {
+        save_idle();
+    }
+}
+
+static void sched_init()
+{
+    scan_task = sched_add("scan", scan_run, NULL, mai_cfg->scan.period, 0, 400);
+    sched_set_catchup(scan_task, mai_cfg->scan.catchup);
+    sched_add("usb", usb_run, tud_task_event_ready, 1000, 1, 100);
+
+    /* background, same priority so none of them runs inside another */
+    sched_add("aime", aime_run, aime_pending, 1000, 2, 200);
+    sched_add("cli", cli_task, NULL, 1000, 2, 200);
+    sched_add("vendor", vendor_task, NULL, 1000, 3, 100);
+    sched_add("save", save_task, NULL, 10000, 3, 800);
+    sched_add("ctrl", runtime_ctrl, NULL, 10000, 3, 50);
 }
 
 static void core0_loop()
 {
     while(1) {
-        main_frame();
-
-        aime_run();
-        save_loop();
-        runtime_ctrl();
+        sched_run();
     }
 }
 
 void init()
 {
     sleep_ms(50);
-    set_sys_clock_khz(150000, true);
-    board_init();
-
-    tusb_init();
-    stdio_init_all();
 
     config_init();
-    mutex_init(&core1_io_lock);
 
-    save_init(board_id_32() ^ 0xcafe1111, &core1_io_lock);
+    save_init(board_id_32() ^ 0xcafe1111, CONFIG_VERSION);
+
+    /* Everything from here on derives its timing from the system clock */
+    clock_init(mai_cfg->clock.profile);
+    if (clock_fault(NULL) != CLOCK_OK) {
+        mai_cfg->clock.profile = clock_profile(); // don't try it again
+        config_changed();
+    }
+    board_init();
+    prof_init();
 
+    /* Descriptors depend on config, so USB comes up after config is loaded */
+    usb_descriptors_build(mai_cfg->usb.profile, mai_cfg->tweak.vendor_port,
+                          mai_cfg->touch_hid.report);
+    mai_runtime.boot.profile = mai_cfg->usb.profile;
     if (!mai_cfg->hid.io4) {
         usb_descriptors_disable_io4();
     }
+    aime_intf = usb_instance(USB_CDC_AIME);
+
+    tusb_init();
+    stdio_init_all();
+    sof_init();
+    mai_runtime.boot.usb_init_us = time_us_32();
 
     touch_init();
     button_init();
-    rgb_init();
 
     nfc_attach_i2c(I2C_PORT);
     nfc_init();
-    nfc_set_wait_loop(main_frame);
+    nfc_set_wait_loop(sched_run);
     aime_init(cdc_aime_putc);
     aime_sub_mode(mai_cfg->aime.mode);
     aime_virtual_aic(mai_cfg->aime.virtual_aic);
@@ -195,8 +255,12 @@ void init()
     cli_init("mai_pico>", "\n   << Mai Pico Controller >>\n"
                             " https://github.com/whowechina\n\n");
     commands_init();
+    io_init();
+    sched_init();
 
     mai_runtime.key_stuck = button_is_stuck();
+    mai_runtime.boot.ready_us = time_us_32();
+    clock_boot_done();
 }
 
 int main(void)
@@ -207,22 +271,19 @@ int main(void)
     return 0;
 }
 
-// Invoked when received GET_REPORT control request
-// Application must fill buffer report's content and return its length.
-// Return zero will cause the stack to STALL request
-uint16_t tud_hid_get_report_cb(uint8_t itf, uint8_t report_id,
-                               hid_report_type_t report_type, uint8_t *buffer,
-                               uint16_t reqlen)
-{
-    printf("Get from USB %d-%d\n", report_id, report_type);
-    return 0;
-}
-
 // Invoked when received SET_REPORT control request or
 // received data on OUT endpoint ( Report ID = 0, Type = 0 )
 void tud_hid_set_report_cb(uint8_t itf, uint8_t report_id,
                            hid_report_type_t report_type, uint8_t const *buffer,
                            uint16_t bufsize)
 {
-    hid_proc(buffer, bufsize);
+    if (usb_hid_port(itf) == USB_HID_IO4) {
+        hid_proc(buffer, bufsize);
+    }
+}
+
+// Invoked when device is mounted
+void tud_mount_cb(void)
+{
+    mai_runtime.boot.mount_us = time_us_32();
 }
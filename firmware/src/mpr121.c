@@ -9,6 +9,7 @@
 
 #include "mpr121.h"
 #include "board_defs.h"
+#include "hot.h"
 
 #define IO_TIMEOUT_US 1000
 
@@ -133,7 +134,7 @@ void mpr121_init(uint8_t i2c_addr)
 
 #define ABS(x) ((x) < 0 ? -(x) : (x))
 
-static bool mpr121_read_many(uint8_t addr, uint8_t reg, uint8_t *buf, size_t n)
+static bool HOT(mpr121_read_many)(uint8_t addr, uint8_t reg, uint8_t *buf, size_t n)
 {
     i2c_write_blocking_until(I2C_PORT, addr, &reg, 1, true,
                              time_us_64() + IO_TIMEOUT_US);
@@ -142,7 +143,7 @@ static bool mpr121_read_many(uint8_t addr, uint8_t reg, uint8_t *buf, size_t n)
     return bytes == n;
 }
 
-static bool mpr121_read_many16(uint8_t addr, uint8_t reg, uint16_t *buf, size_t n)
+static bool HOT(mpr121_read_many16)(uint8_t addr, uint8_t reg, uint16_t *buf, size_t n)
 {
     uint8_t vals[n * 2];
     if (!mpr121_read_many(addr, reg, vals, n * 2)){
@@ -155,7 +156,7 @@ static bool mpr121_read_many16(uint8_t addr, uint8_t reg, uint16_t *buf, size_t
     return true;
 }
 
-uint16_t mpr121_touched(uint8_t addr)
+uint16_t HOT(mpr121_touched)(uint8_t addr)
 {
     uint16_t touched = 0;
     mpr121_read_many16(addr, MPR121_TOUCH_STATUS_REG, &touched, 1);
@@ -0,0 +1,102 @@
+/*
+ * Stage Cycle Profiler
+ * WHowe <github.com/whowechina>
+ *
+ * Cycle counts of each stage per core: min, mean, max and a log2 histogram
+ * for the 99th percentile. Recording is a handful of adds and a CLZ, cheap
+ * enough to stay on all the time. Each core only writes its own stats.
+ * A stage that runs tasks inside it (NFC waits) includes their time.
+ */
+
+#include "prof.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#include "hot.h"
+
+#define HIST_BUCKETS 25 // 24-bit SysTick
+
+static const char *names[PROF_NUM] = {
+    "tud_task", "io", "io_poll", "touch", "button", "hid", "cli",
+    "aime", "save", "vendor", "lights", "rgb",
+};
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t hist[HIST_BUCKETS];
+} stage_stat_t;
+
+static stage_stat_t stats[2][PROF_NUM];
+
+void prof_init()
+{
+    systick_hw->rvr = 0xffffff;
+    systick_hw->csr = 0x5; // enabled, processor clock, no interrupt
+}
+
+void HOT(prof_record)(prof_stage_t stage, uint32_t cycles)
+{
+    stage_stat_t *s = &stats[get_core_num()][stage];
+    if ((s->count == 0) || (cycles < s->min)) {
+        s->min = cycles;
+    }
+    if (cycles > s->max) {
+        s->max = cycles;
+    }
+    s->count++;
+    s->sum += cycles;
+    s->hist[32 - __builtin_clz(cycles | 1)]++;
+}
+
+const char *prof_name(prof_stage_t stage)
+{
+    if (stage >= PROF_NUM) {
+        return "";
+    }
+    return names[stage];
+}
+
+static uint32_t percentile(const stage_stat_t *s, int percent)
+{
+    uint32_t target = ((uint64_t)s->count * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += s->hist[i];
+        if (seen >= target) {
+            uint32_t bound = (1 << i) - 1; // bucket i holds values below 2^i
+            return bound < s->max ? bound : s->max;
+        }
+    }
+    return s->max;
+}
+
+void prof_get_stat(int core, prof_stage_t stage, prof_stat_t *stat)
+{
+    memset(stat, 0, sizeof(*stat));
+    if ((core < 0) || (core > 1) || (stage >= PROF_NUM)) {
+        return;
+    }
+
+    const stage_stat_t *s = &stats[core][stage];
+    if (s->count == 0) {
+        return;
+    }
+    stat->count = s->count;
+    stat->min = s->min;
+    stat->max = s->max;
+    stat->mean = s->sum / s->count;
+    stat->p99 = percentile(s, 99);
+}
+
+void prof_reset()
+{
+    memset(stats, 0, sizeof(stats));
+}
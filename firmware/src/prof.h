@@ -0,0 +1,64 @@
+/*
+ * Stage Cycle Profiler
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hardware/structs/systick.h"
+
+typedef enum {
+    PROF_TUD_TASK,
+    PROF_IO, // scan: host commands and touch report
+    PROF_IO_POLL, // usb: host commands only
+    PROF_TOUCH,
+    PROF_BUTTON,
+    PROF_HID,
+    PROF_CLI,
+    PROF_AIME,
+    PROF_SAVE,
+    PROF_VENDOR,
+    PROF_LIGHTS,
+    PROF_RGB,
+    PROF_NUM
+} prof_stage_t;
+
+void prof_init(); // on each core, it starts the core's own SysTick
+
+/* SysTick counts down with the system clock and wraps at 24 bits,
+   so a single stage can't be longer than about 100ms */
+static inline uint32_t prof_cycles()
+{
+    return systick_hw->cvr;
+}
+
+static inline uint32_t prof_cycles_since(uint32_t start)
+{
+    return (start - systick_hw->cvr) & 0xffffff;
+}
+
+void prof_record(prof_stage_t stage, uint32_t cycles);
+
+#define PROF(stage, ...) do { \
+        uint32_t prof_start = prof_cycles(); \
+        __VA_ARGS__; \
+        prof_record(stage, prof_cycles_since(prof_start)); \
+    } while (0)
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t mean;
+    uint32_t max;
+    uint32_t p99; // upper bound, from a log2 histogram
+} prof_stat_t;
+
+const char *prof_name(prof_stage_t stage);
+void prof_get_stat(int core, prof_stage_t stage, prof_stat_t *stat);
+void prof_reset();
+
+#endif
@@ -14,20 +14,105 @@
 #include "bsp/board.h"
 #include "hardware/pio.h"
 #include "hardware/timer.h"
+#include "hardware/sync.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
 
 #include "ws2812.pio.h"
 
 #include "board_defs.h"
 #include "config.h"
+#include "hot.h"
+#ifdef RGB_BENCH
+#include "prof.h"
+#endif
 
 #define LED_NUM 12 // 8 buttons, 3 cab, 1 aime
-uint32_t rgb_buf[LED_NUM];
+#define PIXEL_MAX (8 * 16 + 3 * 128 + 16)
+
+/* core1 renders LEDs into the pixel framebuffer (back), changed LEDs are
+   then encoded into the DMA buffer (front) which the PIO is fed from */
+static uint32_t pixel_buf[PIXEL_MAX];
+
 static struct {
+    uint8_t per_button;
+    uint8_t per_cab;
+    uint16_t first[LED_NUM + 1]; // first pixel of each LED on the strip
+    uint16_t words; // DMA words per frame
+} layout;
+
+static uint16_t dirty; // LEDs with pixels not yet encoded
+static uint16_t raw; // LEDs with pixels written directly, not from fade
+#define ALL_LEDS ((1 << LED_NUM) - 1)
+
+/* Fades run in 16.16 fixed point from absolute timestamps, per-tick steps
+   are worked out once when a fade starts */
+#define FADE_TICK_SHIFT 8 // 256us per tick
+
+typedef struct {
     uint32_t color; // current color
+    uint32_t start; // color when fade started
     uint32_t target; // target color
-    uint16_t duration;
-    uint16_t elapsed;
-} fade_ctx[LED_NUM];
+    int32_t step[3]; // per tick change of each channel, 16.16
+    uint32_t start_us;
+    uint32_t ticks; // fade length, 0 when not fading
+} fade_t;
+
+/* Each LED fades its first and last pixel, pixels in between are a gradient */
+static fade_t fade_ctx[LED_NUM][2];
+static uint32_t shown[LED_NUM][2];
+
+/* (c + 1)^2 / 256 - 1 */
+static const uint8_t gamma_lut[256] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   3,   3,   3,   3,   3,
+      4,   4,   4,   5,   5,   5,   5,   6,   6,   6,   7,   7,   7,   8,   8,   8,
+      9,   9,  10,  10,  10,  11,  11,  12,  12,  13,  13,  14,  14,  15,  15,  15,
+     16,  17,  17,  18,  18,  19,  19,  20,  20,  21,  21,  22,  23,  23,  24,  24,
+     25,  26,  26,  27,  28,  28,  29,  30,  30,  31,  32,  33,  33,  34,  35,  35,
+     36,  37,  38,  39,  39,  40,  41,  42,  43,  43,  44,  45,  46,  47,  48,  48,
+     49,  50,  51,  52,  53,  54,  55,  56,  57,  58,  59,  60,  61,  62,  63,  63,
+     65,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,  77,  78,  79,  80,
+     82,  83,  84,  85,  86,  87,  89,  90,  91,  92,  93,  95,  96,  97,  98,  99,
+    101, 102, 103, 105, 106, 107, 108, 110, 111, 112, 114, 115, 116, 118, 119, 120,
+    122, 123, 125, 126, 127, 129, 130, 132, 133, 135, 136, 138, 139, 141, 142, 143,
+    145, 147, 148, 150, 151, 153, 154, 156, 157, 159, 160, 162, 164, 165, 167, 168,
+    170, 172, 173, 175, 177, 178, 180, 182, 183, 185, 187, 189, 190, 192, 194, 195,
+    197, 199, 201, 203, 204, 206, 208, 210, 212, 213, 215, 217, 219, 221, 223, 224,
+    226, 228, 230, 232, 234, 236, 238, 240, 242, 244, 246, 248, 250, 252, 254, 255
+};
+
+static uint8_t level_lut[256];
+static int lut_level = -1;
+
+/* Pixels on the strip: buttons, cab and aime at their max configured length */
+#ifdef RGB_PARALLEL_PIN_BASE
+#define DMA_BUF_WORDS (3 * 128 * 3) // longest strip, 3 words per pixel
+#else
+#define DMA_BUF_WORDS PIXEL_MAX
+#endif
+static uint32_t dma_buf[DMA_BUF_WORDS];
+static int dma_chan;
+static volatile bool dma_busy = false;
+static volatile uint32_t dma_done_time = 0;
+
+/* DMA finishes when FIFO takes the last word, PIO still has 8 words to shift
+   out (~240us), then the strip needs its reset low time before next frame */
+#define WS2812_LATCH_US 600
+#define WS2812_REFRESH_US 1000000 // resend unchanged frames once in a while
+
+/* Lock-free single producer (core0) single consumer (core1) queue */
+#define LED_QUEUE_SIZE 64
+static struct {
+    struct {
+        uint8_t index;
+        uint8_t speed;
+        uint32_t color;
+    } ops[LED_QUEUE_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t dropped;
+} led_queue;
 
 static const uint8_t button_led_map[] = RGB_BUTTON_MAP;
 
@@ -42,15 +127,15 @@ static const uint8_t button_led_map[] = RGB_BUTTON_MAP;
 static inline uint32_t _rgb32(uint32_t c1, uint32_t c2, uint32_t c3, bool gamma_fix)
 {
     if (gamma_fix) {
-        c1 = ((c1 + 1) * (c1 + 1) - 1) >> 8;
-        c2 = ((c2 + 1) * (c2 + 1) - 1) >> 8;
-        c3 = ((c3 + 1) * (c3 + 1) - 1) >> 8;
+        c1 = gamma_lut[c1 & 0xff];
+        c2 = gamma_lut[c2 & 0xff];
+        c3 = gamma_lut[c3 & 0xff];
     }
     
     return (c1 << 16) | (c2 << 8) | (c3 << 0);    
 }
 
-uint32_t rgb32(uint32_t r, uint32_t g, uint32_t b, bool gamma_fix)
+uint32_t HOT(rgb32)(uint32_t r, uint32_t g, uint32_t b, bool gamma_fix)
 {
 #if BUTTON_RGB_ORDER == GRB
     return _rgb32(g, r, b, gamma_fix);
@@ -59,7 +144,7 @@ uint32_t rgb32(uint32_t r, uint32_t g, uint32_t b, bool gamma_fix)
 #endif
 }
 
-uint32_t gray32(uint32_t c, bool gamma_fix)
+uint32_t HOT(gray32)(uint32_t c, bool gamma_fix)
 {
     return rgb32(c, c, c, gamma_fix);
 }
@@ -95,127 +180,552 @@ uint32_t rgb32_from_hsv(uint8_t h, uint8_t s, uint8_t v)
     }
 }
 
-static inline uint8_t lerp8b(uint8_t a, uint8_t b, uint8_t t)
+static void HOT(dma_complete)()
 {
-    return a + (b - a) * t / 255;
+    if (dma_channel_get_irq0_status(dma_chan)) {
+        dma_channel_acknowledge_irq0(dma_chan);
+        dma_done_time = time_us_32();
+        dma_busy = false;
+    }
+}
+
+static bool update_level_lut()
+{
+    if (lut_level == mai_cfg->color.level) {
+        return false;
+    }
+    lut_level = mai_cfg->color.level;
+    for (int i = 0; i < 256; i++) {
+        level_lut[i] = i * lut_level / 255;
+    }
+    return true;
 }
 
-static uint32_t lerp(uint32_t a, uint32_t b, uint8_t t)
+static inline uint32_t apply_level(uint32_t color)
 {
-    uint32_t c1 = lerp8b((a >> 16) & 0xff, (b >> 16) & 0xff, t);
-    uint32_t c2 = lerp8b((a >> 8) & 0xff, (b >> 8) & 0xff, t);
-    uint32_t c3 = lerp8b(a & 0xff, b & 0xff, t);
-    return c1 << 16 | c2 << 8 | c3;
+    return level_lut[(color >> 16) & 0xff] << 16 |
+           level_lut[(color >> 8) & 0xff] << 8 |
+           level_lut[color & 0xff];
 }
 
-static void drive_led()
+static inline int led_strip(int led)
 {
-    static uint64_t last = 0;
-    uint64_t now = time_us_64();
-    if (now - last < 4000) { // no faster than 250Hz
+    return led < 8 ? 0 : (led < 11 ? 1 : 2);
+}
+
+/* dma_buf is free to change once the last frame is out and latched */
+static inline bool dma_idle(uint32_t now)
+{
+    return !dma_busy && (now - dma_done_time >= WS2812_LATCH_US);
+}
+
+static bool update_layout(uint32_t now)
+{
+    if ((layout.per_button == mai_cfg->rgb.per_button) &&
+        (layout.per_cab == mai_cfg->rgb.per_cab)) {
+        return false;
+    }
+    if (!dma_idle(now)) {
+        return false; // picked up on a later update
+    }
+
+    layout.per_button = mai_cfg->rgb.per_button;
+    layout.per_cab = mai_cfg->rgb.per_cab;
+
+    int pos = 0;
+    for (int i = 0; i < LED_NUM; i++) {
+        layout.first[i] = pos;
+        pos += i < 8 ? layout.per_button : (i < 11 ? layout.per_cab : 16);
+    }
+    layout.first[LED_NUM] = pos;
+
+#ifdef RGB_PARALLEL_PIN_BASE
+    int longest = 16;
+    if (8 * layout.per_button > longest) {
+        longest = 8 * layout.per_button;
+    }
+    if (3 * layout.per_cab > longest) {
+        longest = 3 * layout.per_cab;
+    }
+    layout.words = longest * 3;
+    memset(dma_buf, 0, sizeof(dma_buf));
+#else
+    layout.words = pos;
+#endif
+
+    return true;
+}
+
+#ifdef RGB_PARALLEL_PIN_BASE
+
+/* Strip n is on bit n of each nibble and each nibble is one bit-time, so
+   one colour byte of one strip spreads into exactly one 32-bit word */
+static uint32_t spread_lut[256];
+
+static void spread_init()
+{
+    for (int i = 0; i < 256; i++) {
+        uint32_t word = 0;
+        for (int bit = 0; bit < 8; bit++) {
+            if (i & (0x80 >> bit)) {
+                word |= 1 << (bit * 4);
+            }
+        }
+        spread_lut[i] = word;
+    }
+}
+
+static void HOT(encode_led)(int led)
+{
+    const int strip_leds[] = { 0, 8, 11 };
+    int strip = led_strip(led);
+    int base = layout.first[strip_leds[strip]];
+    uint32_t keep = ~(0x11111111 << strip);
+
+    for (int i = layout.first[led]; i < layout.first[led + 1]; i++) {
+        uint32_t color = apply_level(pixel_buf[i]);
+        uint32_t *out = dma_buf + (i - base) * 3;
+        out[0] = (out[0] & keep) | (spread_lut[(color >> 16) & 0xff] << strip);
+        out[1] = (out[1] & keep) | (spread_lut[(color >> 8) & 0xff] << strip);
+        out[2] = (out[2] & keep) | (spread_lut[color & 0xff] << strip);
+    }
+}
+
+#else
+
+static void HOT(encode_led)(int led)
+{
+    for (int i = layout.first[led]; i < layout.first[led + 1]; i++) {
+        dma_buf[i] = apply_level(pixel_buf[i]) << 8u;
+    }
+}
+
+#endif
+
+static void HOT(drive_led)(uint32_t now)
+{
+    static uint32_t sent_time = 0;
+
+    if (!dma_idle(now)) {
+        return;
+    }
+
+    if (!dirty && (now - sent_time < WS2812_REFRESH_US)) {
         return;
     }
-    last = now;
 
     for (int i = 0; i < LED_NUM; i++) {
-        int num = i < 8 ? mai_cfg->rgb.per_button : (i < 11 ? mai_cfg->rgb.per_cab : 16);
-        for (int j = 0; j < num; j++) {
-            pio_sm_put_blocking(pio0, 0, rgb_buf[i] << 8u);
+        if (dirty & (1 << i)) {
+            encode_led(i);
         }
     }
+    dirty = 0;
+    sent_time = now;
+
+    dma_busy = true;
+    dma_channel_transfer_from_buffer_now(dma_chan, dma_buf, layout.words);
 }
 
-static inline uint32_t apply_level(uint32_t color)
+static inline uint32_t fade_channel(uint32_t start, int32_t step, int32_t elapsed, int shift)
 {
-    unsigned r = (color >> 16) & 0xff;
-    unsigned g = (color >> 8) & 0xff;
-    unsigned b = color & 0xff;
+    int32_t from = (start >> shift) & 0xff;
+    return ((from << 16) + step * elapsed) >> 16;
+}
 
-    r = r * mai_cfg->color.level / 255;
-    g = g * mai_cfg->color.level / 255;
-    b = b * mai_cfg->color.level / 255;
+static void HOT(fade_step)(fade_t *fade, uint32_t now_us)
+{
+    if (fade->ticks == 0) {
+        return;
+    }
 
-    return r << 16 | g << 8 | b;
+    uint32_t elapsed = (now_us - fade->start_us) >> FADE_TICK_SHIFT;
+    if (elapsed >= fade->ticks) {
+        fade->ticks = 0;
+        fade->color = fade->target;
+        return;
+    }
+
+    fade->color = fade_channel(fade->start, fade->step[0], elapsed, 16) << 16 |
+                  fade_channel(fade->start, fade->step[1], elapsed, 8) << 8 |
+                  fade_channel(fade->start, fade->step[2], elapsed, 0);
 }
 
-static void fade_ctrl()
+static void HOT(fade_start)(fade_t *fade, uint32_t color, uint8_t speed)
 {
-    static uint64_t last = 0;
-    uint64_t now = time_us_64();
-    uint32_t delta_ms = (now - last) / 1000;
+    fade->target = color;
 
-    if (delta_ms < 4) { // no faster than 250Hz
+    if (speed == 0) {
+        fade->color = color;
+        fade->ticks = 0;
         return;
     }
 
-    for (int i = 0; i < count_of(fade_ctx); i++) {
-        if (fade_ctx[i].duration == 0) {
-            continue;
+    uint32_t duration_ms = 4095 / speed * 8;
+    uint32_t ticks = (duration_ms * 1000) >> FADE_TICK_SHIFT;
+    uint32_t from = fade->color;
+
+    for (int i = 0; i < 3; i++) {
+        int shift = 16 - i * 8;
+        int32_t diff = (int32_t)((color >> shift) & 0xff) - (int32_t)((from >> shift) & 0xff);
+        fade->step[i] = diff * 65536 / (int32_t)ticks;
+    }
+    fade->start = from;
+    fade->start_us = time_us_32();
+    fade->ticks = ticks;
+}
+
+static void HOT(render_led)(int led)
+{
+    uint32_t head = shown[led][0];
+    uint32_t tail = shown[led][1];
+    uint32_t *pixels = pixel_buf + layout.first[led];
+    int num = layout.first[led + 1] - layout.first[led];
+
+    if ((head == tail) || (num < 2)) {
+        for (int i = 0; i < num; i++) {
+            pixels[i] = head;
         }
+        return;
+    }
+
+    int32_t step[3];
+    for (int c = 0; c < 3; c++) {
+        int shift = 16 - c * 8;
+        int32_t diff = (int32_t)((tail >> shift) & 0xff) - (int32_t)((head >> shift) & 0xff);
+        step[c] = diff * 65536 / (num - 1);
+    }
+    for (int i = 0; i < num; i++) {
+        pixels[i] = fade_channel(head, step[0], i, 16) << 16 |
+                    fade_channel(head, step[1], i, 8) << 8 |
+                    fade_channel(head, step[2], i, 0);
+    }
+}
 
-        fade_ctx[i].elapsed += delta_ms;
-        if (fade_ctx[i].elapsed >= fade_ctx[i].duration) {
-            fade_ctx[i].duration = 0;
-            rgb_buf[i] = fade_ctx[i].target;
+static void HOT(fade_ctrl)(uint32_t now_us, bool rerender)
+{
+    for (int i = 0; i < LED_NUM; i++) {
+        fade_step(&fade_ctx[i][0], now_us);
+        fade_step(&fade_ctx[i][1], now_us);
+
+        if (raw & (1 << i)) {
             continue;
         }
 
-        uint8_t progress = fade_ctx[i].elapsed * 255 / fade_ctx[i].duration;
-        uint32_t color = lerp(fade_ctx[i].color, fade_ctx[i].target, progress);
-        rgb_buf[i] = apply_level(color);
+        uint32_t head = fade_ctx[i][0].color;
+        uint32_t tail = fade_ctx[i][1].color;
+        if (rerender || (head != shown[i][0]) || (tail != shown[i][1])) {
+            shown[i][0] = head;
+            shown[i][1] = tail;
+            render_led(i);
+            dirty |= 1 << i;
+        }
     }
+}
 
-    last = now;
+static void set_gradient(unsigned index, uint32_t head, uint32_t tail, uint8_t speed)
+{
+    if (index >= LED_NUM) {
+        return;
+    }
+
+    fade_start(&fade_ctx[index][0], head, speed);
+    fade_start(&fade_ctx[index][1], tail, speed);
+    if (raw & (1 << index)) {
+        raw &= ~(1 << index);
+        shown[index][0] = ~head; // forces a re-render
+    }
+}
+
+static void HOT(set_color)(unsigned index, uint32_t color, uint8_t speed)
+{
+    set_gradient(index, color, color, speed);
+}
+
+static void set_pixel(unsigned index, unsigned pixel, uint32_t color)
+{
+    if (pixel >= layout.first[index + 1] - layout.first[index]) {
+        return;
+    }
+
+    pixel_buf[layout.first[index] + pixel] = color;
+    raw |= 1 << index;
+    dirty |= 1 << index;
 }
 
-static void set_color(unsigned index, uint32_t color, uint8_t speed)
+static inline void queue_op(uint32_t pos, unsigned index, uint32_t color, uint8_t speed)
 {
-    if (index >= count_of(fade_ctx)) {
+    led_queue.ops[pos % LED_QUEUE_SIZE].index = index;
+    led_queue.ops[pos % LED_QUEUE_SIZE].speed = speed;
+    led_queue.ops[pos % LED_QUEUE_SIZE].color = color;
+}
+
+static void HOT(queue_color)(unsigned index, uint32_t color, uint8_t speed)
+{
+    uint32_t head = led_queue.head;
+    if (head - led_queue.tail >= LED_QUEUE_SIZE) {
+        led_queue.dropped++;
         return;
     }
 
-    if (speed > 0) {
-        fade_ctx[index].target = color;
-        fade_ctx[index].duration = 4095 / speed * 8;
-        fade_ctx[index].elapsed = 0;
+    queue_op(head, index, color, speed);
+    __dmb(); // op must be visible before the head moves
+    led_queue.head = head + 1;
+}
+
+/* All ops of a frame are published with one head move, apply_queue() takes
+   them in one go, so a frame never shows half applied */
+static void HOT(queue_frame)(const uint32_t button[8], const uint32_t cab[3])
+{
+    uint32_t head = led_queue.head;
+    if (head - led_queue.tail > LED_QUEUE_SIZE - 11) {
+        led_queue.dropped++;
+        return;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        queue_op(head + i, button_led_map[i], button[i], 0);
+    }
+    for (int i = 0; i < 3; i++) {
+        queue_op(head + 8 + i, 8 + i, cab[i], 0);
+    }
+    __dmb();
+    led_queue.head = head + 11;
+}
+
+static void HOT(apply_queue)()
+{
+    uint32_t head = led_queue.head;
+    __dmb();
+
+    uint32_t tail = led_queue.tail;
+    while (tail != head) {
+        set_color(led_queue.ops[tail % LED_QUEUE_SIZE].index,
+                  led_queue.ops[tail % LED_QUEUE_SIZE].color,
+                  led_queue.ops[tail % LED_QUEUE_SIZE].speed);
+        tail++;
+    }
+
+    __dmb(); // done reading before the slots are handed back
+    led_queue.tail = tail;
+}
+
+/* LED state is owned by core1, core0 goes through the queue */
+static void HOT(update_color)(unsigned index, uint32_t color, uint8_t speed)
+{
+    if (get_core_num() == 1) {
+        set_color(index, color, speed);
     } else {
-        fade_ctx[index].color= color;
-        fade_ctx[index].duration = 0;
-        rgb_buf[index] = apply_level(color);
+        queue_color(index, color, speed);
+    }
+}
+
+void HOT(rgb_set_button)(unsigned index, uint32_t color, uint8_t speed)
+{
+    if (index >= 8) {
+        return;
+    }
+    update_color(button_led_map[index], color, speed);
+}
+
+void HOT(rgb_set_cab)(unsigned index, uint32_t color)
+{
+    if (index >= 3) {
+        return;
+    }
+    update_color(8 + index, color, 0);
+}
+
+void HOT(rgb_set_aime)(uint32_t color)
+{
+    update_color(11, color, 0);
+}
+
+void HOT(rgb_set_frame)(const uint32_t button[8], const uint32_t cab[3])
+{
+    if (get_core_num() == 0) {
+        queue_frame(button, cab);
+        return;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        set_color(button_led_map[i], button[i], 0);
+    }
+    for (int i = 0; i < 3; i++) {
+        set_color(8 + i, cab[i], 0);
     }
 }
 
-void rgb_set_button(unsigned index, uint32_t color, uint8_t speed)
+void rgb_set_button_gradient(unsigned index, uint32_t head, uint32_t tail, uint8_t speed)
 {
     if (index >= 8) {
         return;
     }
-    set_color(button_led_map[index], color, speed);
+    set_gradient(button_led_map[index], head, tail, speed);
 }
 
-void rgb_set_cab(unsigned index, uint32_t color)
+void rgb_set_cab_gradient(unsigned index, uint32_t head, uint32_t tail)
 {
     if (index >= 3) {
         return;
     }
-    set_color(8 + index, color, 0);
+    set_gradient(8 + index, head, tail, 0);
 }
 
-void rgb_set_aime(uint32_t color)
+void rgb_set_button_pixel(unsigned index, unsigned pixel, uint32_t color)
 {
-    set_color(11, color, 0);
+    if (index >= 8) {
+        return;
+    }
+    set_pixel(button_led_map[index], pixel, color);
 }
 
+void rgb_set_cab_pixel(unsigned index, unsigned pixel, uint32_t color)
+{
+    if (index >= 3) {
+        return;
+    }
+    set_pixel(8 + index, pixel, color);
+}
+
+unsigned rgb_button_pixel_num()
+{
+    return layout.per_button;
+}
+
+unsigned rgb_cab_pixel_num()
+{
+    return layout.per_cab;
+}
+
+#ifdef RGB_BENCH
+/* What fades and brightness did per LED before the tables and fixed
+   point, only kept to measure against */
+static inline uint8_t legacy_lerp8b(uint8_t a, uint8_t b, uint8_t t)
+{
+    return a + (b - a) * t / 255;
+}
+
+static uint32_t legacy_fade(uint32_t from, uint32_t to, uint16_t elapsed, uint16_t duration)
+{
+    uint8_t t = elapsed * 255 / duration;
+    return legacy_lerp8b(from >> 16, to >> 16, t) << 16 |
+           legacy_lerp8b(from >> 8, to >> 8, t) << 8 |
+           legacy_lerp8b(from, to, t);
+}
+
+static uint32_t legacy_level(uint32_t color, uint8_t level)
+{
+    unsigned r = ((color >> 16) & 0xff) * level / 255;
+    unsigned g = ((color >> 8) & 0xff) * level / 255;
+    unsigned b = (color & 0xff) * level / 255;
+    return r << 16 | g << 8 | b;
+}
+
+#define BENCH_ROUNDS 16
+
+void rgb_bench(rgb_bench_t *bench)
+{
+    fade_t fades[LED_NUM * 2];
+    uint32_t now = time_us_32();
+    for (int i = 0; i < count_of(fades); i++) {
+        fades[i].color = rgb32_from_hsv(i * 10, 255, 255);
+        fade_start(&fades[i], rgb32_from_hsv(i * 10 + 128, 255, 128), 20);
+    }
+
+    uint16_t duration = 4095 / 20 * 8;
+    uint8_t level = mai_cfg->color.level;
+    int pixels = layout.first[LED_NUM];
+    volatile uint32_t sink = 0; // keeps the work from being optimized out
+
+    uint32_t start = prof_cycles();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (int i = 0; i < count_of(fades); i++) {
+            fade_step(&fades[i], now + r * 4000);
+            sink += fades[i].color;
+        }
+    }
+    bench->fade = prof_cycles_since(start) / BENCH_ROUNDS;
+
+    start = prof_cycles();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (int i = 0; i < count_of(fades); i++) {
+            sink += legacy_fade(fades[i].start, fades[i].target, r * 4 + i, duration);
+        }
+    }
+    bench->legacy_fade = prof_cycles_since(start) / BENCH_ROUNDS;
+
+    start = prof_cycles();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (int i = 0; i < pixels; i++) {
+            sink += apply_level(fades[i % count_of(fades)].color + r);
+        }
+    }
+    bench->level = prof_cycles_since(start) / BENCH_ROUNDS;
+
+    start = prof_cycles();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (int i = 0; i < pixels; i++) {
+            sink += legacy_level(fades[i % count_of(fades)].color + r, level);
+        }
+    }
+    bench->legacy_level = prof_cycles_since(start) / BENCH_ROUNDS;
+    bench->pixels = pixels;
+}
+#endif
+
 void rgb_init()
 {
+#ifdef RGB_PARALLEL_PIN_BASE
+    uint pio0_offset = pio_add_program(pio0, &ws2812_parallel_program);
+
+    for (int i = 0; i < 3; i++) {
+        gpio_set_drive_strength(RGB_PARALLEL_PIN_BASE + i, GPIO_DRIVE_STRENGTH_2MA);
+    }
+    ws2812_parallel_program_init(pio0, 0, pio0_offset, RGB_PARALLEL_PIN_BASE, 3, 800000);
+    spread_init();
+#else
     uint pio0_offset = pio_add_program(pio0, &ws2812_program);
 
     gpio_set_drive_strength(RGB_PIN, GPIO_DRIVE_STRENGTH_2MA);
     ws2812_program_init(pio0, 0, pio0_offset, RGB_PIN, 800000, false);
+#endif
+
+    dma_chan = dma_claim_unused_channel(true);
+    dma_channel_config cfg = dma_channel_get_default_config(dma_chan);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_dreq(&cfg, pio_get_dreq(pio0, 0, true));
+    dma_channel_configure(dma_chan, &cfg, &pio0->txf[0], dma_buf, 0, false);
+
+    dma_channel_set_irq0_enabled(dma_chan, true);
+    irq_add_shared_handler(DMA_IRQ_0, dma_complete,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    update_layout(time_us_32());
+    dirty = ALL_LEDS;
 }
 
-void rgb_update()
+void HOT(rgb_update)()
 {
-    fade_ctrl();
-    drive_led();
+    apply_queue();
+
+    static uint32_t last = 0;
+    uint32_t now = time_us_32();
+    if (now - last < 4000) { // no faster than 250Hz
+        return;
+    }
+    last = now;
+
+    bool relayout = update_layout(now);
+    if (relayout) {
+        raw = 0;
+    }
+    if (update_level_lut()) {
+        dirty = ALL_LEDS;
+    }
+
+    fade_ctrl(now, relayout);
+    drive_led(now);
 }
@@ -12,15 +12,40 @@
 
 #include "config.h"
 
-void rgb_init();
+void rgb_init(); // on core1, LED DMA interrupt goes to the calling core
 void rgb_update();
 
 uint32_t rgb32(uint32_t r, uint32_t g, uint32_t b, bool gamma_fix);
 uint32_t gray32(uint32_t c, bool gamma_fix);
 uint32_t rgb32_from_hsv(uint8_t h, uint8_t s, uint8_t v);
 
+/* Safe on both cores, core0 calls are applied by core1 at next frame */
 void rgb_set_button(unsigned index, uint32_t color, uint8_t speed);
 void rgb_set_cab(unsigned index, uint32_t color);
 void rgb_set_aime(uint32_t color);
+/* All 8 buttons and 3 cab LEDs, shown together at the same LED frame */
+void rgb_set_frame(const uint32_t button[8], const uint32_t cab[3]);
+
+/* Per-pixel access, core1 only. A pixel write keeps the LED off the fade
+   engine until its next color or gradient is set */
+void rgb_set_button_gradient(unsigned index, uint32_t head, uint32_t tail, uint8_t speed);
+void rgb_set_cab_gradient(unsigned index, uint32_t head, uint32_t tail);
+void rgb_set_button_pixel(unsigned index, unsigned pixel, uint32_t color);
+void rgb_set_cab_pixel(unsigned index, unsigned pixel, uint32_t color);
+unsigned rgb_button_pixel_num();
+unsigned rgb_cab_pixel_num();
+
+#ifdef RGB_BENCH
+typedef struct {
+    uint32_t fade; // cycles for one LED frame, both ends of every LED
+    uint32_t level; // cycles for one LED frame, every pixel
+    uint32_t legacy_fade; // same work with the divides used before
+    uint32_t legacy_level;
+    uint16_t pixels;
+} rgb_bench_t;
+
+/* Runs the fade and brightness code on copies, safe on either core */
+void rgb_bench(rgb_bench_t *bench);
+#endif
 
 #endif
@@ -1,112 +1,433 @@
 /*
  * Controller Config Save and Load
  * WHowe <github.com/whowechina>
- * 
- * Config is stored in last sector of flash
+ *
+ * Config is kept as an append-only log over the last few sectors of
+ * flash. Each save is a one-page record with a sequence number, a schema
+ * version and a CRC. The first page of each sector is its head: the
+ * sector's own sequence number and a bitmap, one bit cleared for each
+ * slot that holds a record. Boot reads the heads to find the newest
+ * sector, and its bitmap gives the latest record without scanning.
+ *
+ * Sectors are used in turn, so each one is erased only once every
+ * SAVE_SECTOR_NUM * SLOT_NUM saves. The sector after the current one is
+ * erased ahead of time while the player is idle, and a save that would
+ * move on to it before then is put off until it's done. So a save only
+ * programs pages: the record, then the head again for its bit, plus the head
+ * first when the record opens a new sector. Each page is a step of its
+ * own on a later save_loop(). During a flash op core1 is parked by the
+ * multicore lockout and core0 has interrupts off, so a blackout is never
+ * longer than one page program, and it is measured.
  */
 
 #include "save.h"
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <memory.h>
+#include <assert.h>
 
 #include "pico/bootrom.h"
 #include "pico/stdio.h"
+#include "pico/stdlib.h"
 
 #include "hardware/flash.h"
+#include "hardware/sync.h"
 #include "pico/multicore.h"
 #include "pico/unique_id.h"
 
+#include "trace.h"
+
 static struct {
     size_t size;
     size_t offset;
+    void (*migrate)(uint16_t from);
     void (*after_load)();
 } modules[8] = {0};
 static int module_num = 0;
 
 static uint32_t my_magic = 0xcafecafe;
+static uint16_t my_version = 0;
 
 #define SAVE_TIMEOUT_US 5000000
 
-#define SAVE_SECTOR_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#define SAVE_SECTOR_NUM 8
+#define SAVE_SECTOR_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE * SAVE_SECTOR_NUM)
+#define PAGES_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define SLOT_NUM (PAGES_PER_SECTOR - 1) // page 0 is the head
+#define SLOT_MASK ((1 << SLOT_NUM) - 1)
+
+/* Saves from before the log: bare pages led by the magic, filled in
+   order through the last two sectors, or only the last one */
+#define LEGACY_SECTOR (SAVE_SECTOR_NUM - 2)
+#define LEGACY_DATA_SIZE (FLASH_PAGE_SIZE - 4)
 
-typedef struct __attribute ((packed)) {
+typedef struct __attribute__((packed)) {
+    uint32_t magic; // ~my_magic, so it never passes as a legacy page
+    uint32_t seq;
+    uint32_t crc; // of magic and seq
+    uint32_t used; // bit n cleared once slot n holds a record
+} head_t;
+
+typedef struct __attribute__((packed)) {
     uint32_t magic;
-    uint8_t data[FLASH_PAGE_SIZE - 4];
-} page_t;
+    uint32_t seq;
+    uint16_t version;
+    uint16_t len;
+    uint32_t crc; // of seq, version, len and data
+    uint8_t data[SAVE_DATA_SIZE];
+} record_t;
+
+static_assert(sizeof(record_t) == FLASH_PAGE_SIZE, "A record takes one page");
+
+static uint8_t old_data[SAVE_DATA_SIZE];
+static uint8_t new_data[SAVE_DATA_SIZE];
+static uint8_t default_data[SAVE_DATA_SIZE];
+static size_t data_size = 0;
+static uint16_t loaded_version = 0;
+static bool must_save = false; // nothing valid or an older version loaded
+
+/* Where the next record goes */
+static struct {
+    int sector;
+    int slot;
+    uint32_t sector_seq;
+    uint32_t seq;
+} cursor = { SAVE_SECTOR_NUM - 1, SLOT_NUM, 0, 0 };
+
+static bool next_erased = false;
 
-static page_t old_data = {0};
-static page_t new_data = {0};
-static page_t default_data = {0};
-static int data_page = -1;
+/* What the save in progress programs on the next save_loop() */
+static enum {
+    STEP_NONE,
+    STEP_HEAD,
+    STEP_RECORD,
+    STEP_MARK,
+} step = STEP_NONE;
+
+static record_t rec;
+static union {
+    head_t head;
+    uint8_t page[FLASH_PAGE_SIZE];
+} head;
 
 static bool requesting_save = false;
 static uint64_t requesting_time = 0;
+static bool holding_save = false;
+
+static save_stat_t stat;
+
+static uint32_t crc32(const void *data, size_t len, uint32_t crc)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+        0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    const uint8_t *p = data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ p[i]) & 0x0f] ^ (crc >> 4);
+        crc = table[(crc ^ (p[i] >> 4)) & 0x0f] ^ (crc >> 4);
+    }
+    return ~crc;
+}
 
-static mutex_t *io_lock;
+static uint32_t head_crc(const head_t *head)
+{
+    return crc32(head, offsetof(head_t, crc), 0);
+}
+
+static uint32_t record_crc(const record_t *rec, size_t len)
+{
+    uint32_t crc = crc32(&rec->seq, offsetof(record_t, crc) - offsetof(record_t, seq), 0);
+    return crc32(rec->data, len, crc);
+}
 
-static void save_program()
+static uint32_t sector_offset(int sector)
 {
-    old_data = new_data;
+    return SAVE_SECTOR_OFFSET + sector * FLASH_SECTOR_SIZE;
+}
 
-    data_page = (data_page + 1) % (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE);
-    printf("\nProgram Flash %d %8lx\n", data_page, old_data.magic);
-    if (mutex_enter_timeout_us(io_lock, 100000)) {
-        sleep_ms(10); /* wait for all io operations to finish */
-        uint32_t ints = save_and_disable_interrupts();
-        if (data_page == 0) {
-            flash_range_erase(SAVE_SECTOR_OFFSET, FLASH_SECTOR_SIZE);
+static const head_t *get_head(int sector)
+{
+    return (const head_t *)(XIP_BASE + sector_offset(sector));
+}
+
+static const record_t *get_record(int sector, int slot)
+{
+    return (const record_t *)(XIP_BASE + sector_offset(sector) + FLASH_PAGE_SIZE * (slot + 1));
+}
+
+static bool is_blank(uint32_t offset, size_t size)
+{
+    const uint32_t *word = (const uint32_t *)(XIP_BASE + offset);
+    for (int i = 0; i < size / 4; i++) {
+        if (word[i] != 0xffffffff) {
+            return false;
         }
-        flash_range_program(SAVE_SECTOR_OFFSET + data_page * FLASH_PAGE_SIZE,
-                            (uint8_t *)&old_data, FLASH_PAGE_SIZE);
-        restore_interrupts(ints);
-        mutex_exit(io_lock);
-    } else {
-        printf("Program Flash Failed.\n");
     }
+    return true;
 }
 
-static void load_default()
+static bool head_valid(int sector)
 {
-    printf("Load Default\n");
-    new_data = default_data;
-    new_data.magic = my_magic;
+    const head_t *head = get_head(sector);
+    return (head->magic == ~my_magic) && (head->crc == head_crc(head));
 }
 
-static const page_t *get_page(int id)
+static int used_slots(int sector)
 {
-    int addr = XIP_BASE + SAVE_SECTOR_OFFSET;
-    return (page_t *)(addr + FLASH_PAGE_SIZE * id);
+    return __builtin_popcount(~get_head(sector)->used & SLOT_MASK);
 }
 
-static void save_load()
+static bool record_valid(const record_t *rec)
 {
-    for (int i = 0; i < FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE; i++) {
-        if (get_page(i)->magic != my_magic) {
+    return (rec->magic == my_magic) && (rec->len <= SAVE_DATA_SIZE) &&
+           (rec->crc == record_crc(rec, rec->len));
+}
+
+static void record_blackout(save_op_stat_t *op, uint32_t us)
+{
+    op->count++;
+    op->last_us = us;
+    if (us > op->max_us) {
+        op->max_us = us;
+    }
+}
+
+/* Core1 is parked in RAM and core0 takes no interrupts while flash is
+   busy, nothing may run from XIP meanwhile */
+static uint32_t flash_begin()
+{
+    if (multicore_lockout_victim_is_initialized(1)) {
+        multicore_lockout_start_blocking();
+    }
+    return save_and_disable_interrupts();
+}
+
+static void flash_end(uint32_t ints)
+{
+    restore_interrupts(ints);
+    if (multicore_lockout_victim_is_initialized(1)) {
+        multicore_lockout_end_blocking();
+    }
+}
+
+static void erase_sector(int sector)
+{
+    uint64_t start = time_us_64();
+    uint32_t ints = flash_begin();
+    flash_range_erase(sector_offset(sector), FLASH_SECTOR_SIZE);
+    flash_end(ints);
+    record_blackout(&stat.erase, time_us_64() - start);
+    trace(TRACE_SAVE_ERASE, sector, stat.erase.last_us);
+}
+
+/* The next save moves on to a sector that save_idle() hasn't erased yet */
+static bool erase_pending()
+{
+    if ((cursor.slot < SLOT_NUM) || next_erased) {
+        return false;
+    }
+    next_erased = is_blank(sector_offset((cursor.sector + 1) % SAVE_SECTOR_NUM),
+                           FLASH_SECTOR_SIZE);
+    return !next_erased;
+}
+
+static void next_sector()
+{
+    cursor.sector = (cursor.sector + 1) % SAVE_SECTOR_NUM;
+    cursor.slot = 0;
+    cursor.sector_seq++;
+    next_erased = false;
+}
+
+static void program_page(int page, const void *data)
+{
+    uint32_t offset = sector_offset(cursor.sector) + FLASH_PAGE_SIZE * page;
+    uint64_t start = time_us_64();
+    uint32_t ints = flash_begin();
+    flash_range_program(offset, data, FLASH_PAGE_SIZE);
+    flash_end(ints);
+    record_blackout(&stat.program, time_us_64() - start);
+    trace(TRACE_SAVE_PROGRAM, (cursor.sector << 8) | page, stat.program.last_us);
+}
+
+static void save_start()
+{
+    memcpy(old_data, new_data, sizeof(old_data));
+    must_save = false;
+    holding_save = false;
+
+    if (cursor.slot >= SLOT_NUM) {
+        next_sector();
+    }
+
+    cursor.seq++;
+    rec.magic = my_magic;
+    rec.seq = cursor.seq;
+    rec.version = my_version;
+    rec.len = data_size;
+    memcpy(rec.data, old_data, sizeof(rec.data));
+    rec.crc = record_crc(&rec, rec.len);
+
+    memset(head.page, 0xff, sizeof(head.page));
+    head.head.magic = ~my_magic;
+    head.head.seq = cursor.sector_seq;
+    head.head.crc = head_crc(&head.head);
+    head.head.used = 0xffffffff;
+
+    step = (cursor.slot == 0) ? STEP_HEAD : STEP_RECORD;
+}
+
+/* A new sector gets its head before its first record, each record goes
+   in before its bit in the head. A power cut in between leaves a record
+   past the bitmap of a valid head, which boot still finds, or a head with
+   no record yet, which boot passes over to the sector before. */
+static void save_step()
+{
+    switch (step) {
+        case STEP_HEAD:
+            program_page(0, head.page);
+            step = STEP_RECORD;
+            break;
+        case STEP_RECORD:
+            program_page(cursor.slot + 1, &rec);
+            step = STEP_MARK;
             break;
+        case STEP_MARK:
+            /* programming only clears bits, rewriting the head is fine */
+            head.head.used = ~((2 << cursor.slot) - 1);
+            program_page(0, head.page);
+            cursor.slot++;
+            step = STEP_NONE;
+            break;
+        default:
+            break;
+    }
+}
+
+/* Newest valid record, normally the one the newest head points to. Torn
+   or corrupted ones are passed over, back into older sectors if needed. */
+static const record_t *find_latest()
+{
+    int newest = -1;
+    for (int i = 0; i < SAVE_SECTOR_NUM; i++) {
+        if (head_valid(i) &&
+            ((newest < 0) || (get_head(i)->seq > get_head(newest)->seq))) {
+            newest = i;
         }
-        data_page = i;
+    }
+    if (newest < 0) {
+        return NULL;
     }
 
-    if (data_page < 0) {
-        load_default();
-        save_request(false);
-        return;
+    int last = used_slots(newest) - 1;
+    while ((last + 1 < SLOT_NUM) &&
+           !is_blank(sector_offset(newest) + FLASH_PAGE_SIZE * (last + 2), FLASH_PAGE_SIZE)) {
+        last++; // programmed but not marked
+    }
+    cursor.sector = newest;
+    cursor.slot = last + 1;
+    cursor.sector_seq = get_head(newest)->seq;
+
+    for (int i = 0; i < SAVE_SECTOR_NUM; i++) {
+        int sector = (newest + SAVE_SECTOR_NUM - i) % SAVE_SECTOR_NUM;
+        if (i > 0) {
+            if (!head_valid(sector) || (get_head(sector)->seq != cursor.sector_seq - i)) {
+                break;
+            }
+            last = used_slots(sector) - 1;
+        }
+        for (; last >= 0; last--) {
+            const record_t *rec = get_record(sector, last);
+            if (record_valid(rec)) {
+                cursor.seq = rec->seq;
+                return rec;
+            }
+            stat.bad_records++;
+            trace(TRACE_SAVE_CORRUPT, (sector << 8) | last, rec->crc);
+        }
+    }
+    return NULL;
+}
+
+static const uint8_t *find_legacy()
+{
+    int last[2];
+    for (int i = 0; i < 2; i++) {
+        last[i] = -1;
+        for (int page = 0; page < PAGES_PER_SECTOR; page++) {
+            uint32_t offset = sector_offset(LEGACY_SECTOR + i) + FLASH_PAGE_SIZE * page;
+            if (*(const uint32_t *)(XIP_BASE + offset) != my_magic) {
+                break;
+            }
+            last[i] = page;
+        }
+    }
+
+    /* both hold saves only after moving on, then the one not full is newer */
+    int sector = 1;
+    if ((last[0] >= 0) && ((last[1] < 0) || (last[1] == PAGES_PER_SECTOR - 1))) {
+        sector = 0;
+    }
+    if (last[sector] < 0) {
+        return NULL;
     }
 
-    old_data = *get_page(data_page);
-    new_data = old_data;
-    printf("Page Loaded %d %8lx\n", data_page, new_data.magic);
+    uint32_t offset = sector_offset(LEGACY_SECTOR + sector) + FLASH_PAGE_SIZE * last[sector];
+    return (const uint8_t *)(XIP_BASE + offset + 4);
+}
+
+static void save_load()
+{
+    uint64_t start = time_us_64();
+    memcpy(new_data, default_data, sizeof(new_data));
+
+    const record_t *rec = find_latest();
+    const uint8_t *legacy = rec ? NULL : find_legacy();
+    if (rec) {
+        /* a module added since keeps its default */
+        memcpy(new_data, rec->data, rec->len);
+        loaded_version = rec->version;
+        trace(TRACE_SAVE_LOAD, ((uintptr_t)rec - XIP_BASE - SAVE_SECTOR_OFFSET) / FLASH_PAGE_SIZE,
+              rec->seq);
+    } else if (legacy) {
+        memcpy(new_data, legacy, LEGACY_DATA_SIZE < SAVE_DATA_SIZE ? LEGACY_DATA_SIZE : SAVE_DATA_SIZE);
+        loaded_version = 0;
+        trace(TRACE_SAVE_LOAD, 0xfffe, 0);
+    } else {
+        loaded_version = my_version;
+        must_save = true;
+        trace(TRACE_SAVE_LOAD, 0xffff, 0);
+    }
+
+    if (loaded_version != my_version) {
+        must_save = true; // into the log in the current version
+        trace(TRACE_SAVE_MIGRATE, loaded_version, my_version);
+    }
+
+    memcpy(old_data, new_data, sizeof(old_data));
+    stat.load_us = time_us_64() - start;
+    stat.version = loaded_version;
 }
 
 static void save_loaded()
 {
     for (int i = 0; i < module_num; i++) {
+        if ((loaded_version != my_version) && modules[i].migrate) {
+            modules[i].migrate(loaded_version);
+        }
         modules[i].after_load();
     }
+    if (must_save) {
+        save_request(false);
+    }
 }
 
 static union __attribute__((packed)) {
@@ -130,44 +451,85 @@ uint64_t board_id_64()
     return board_id.id64;
 }
 
-void save_init(uint32_t magic, mutex_t *locker)
+void save_init(uint32_t magic, uint16_t version)
 {
     my_magic = magic;
-    io_lock = locker;
+    my_version = version;
     save_load();
-    save_loop();
     save_loaded();
+    save_idle(); // nothing is running yet, a good time to erase
+}
+
+/* Erase the sector after the current one, so the next save that moves
+   on to it doesn't have to */
+void save_idle()
+{
+    if (next_erased) {
+        return;
+    }
+    int next = (cursor.sector + 1) % SAVE_SECTOR_NUM;
+    if (!is_blank(sector_offset(next), FLASH_SECTOR_SIZE)) {
+        erase_sector(next);
+    }
+    next_erased = true;
+}
+
+void save_get_stat(save_stat_t *out)
+{
+    *out = stat;
+    out->sector = cursor.sector;
+    out->slot = cursor.slot;
+    out->seq = cursor.seq;
 }
 
 void save_loop()
 {
+    if (step != STEP_NONE) {
+        save_step();
+        return;
+    }
     if (requesting_save && (time_us_64() - requesting_time > SAVE_TIMEOUT_US)) {
-        requesting_save = false;
         /* only when data is actually changed */
-        if (memcmp(&old_data, &new_data, sizeof(old_data)) == 0) {
+        if (!must_save && (memcmp(old_data, new_data, sizeof(old_data)) == 0)) {
+            requesting_save = false;
             return;
         }
-        save_program();
+        /* an erase now would black out for tens of ms, wait for idle */
+        if (erase_pending()) {
+            if (!holding_save) {
+                holding_save = true;
+                stat.held++;
+            }
+            return;
+        }
+        requesting_save = false;
+        save_start();
+        save_step();
     }
 }
 
-void *save_alloc(size_t size, void *def, void (*after_load)())
+void *save_alloc(size_t size, void *def, void (*migrate)(uint16_t from),
+                 void (*after_load)())
 {
+    if ((module_num >= count_of(modules)) || (data_size + size > SAVE_DATA_SIZE)) {
+        return NULL;
+    }
     modules[module_num].size = size;
-    size_t offset = module_num > 0 ? modules[module_num - 1].offset + size : 0;
-    modules[module_num].offset = offset;
+    modules[module_num].offset = data_size;
+    modules[module_num].migrate = migrate;
     modules[module_num].after_load = after_load;
     module_num++;
-    memcpy(default_data.data + offset, def, size); // backup the default
-    return new_data.data + offset;
+    memcpy(default_data + data_size, def, size); // backup the default
+    void *data = new_data + data_size;
+    data_size += size;
+    return data;
 }
 
 void save_request(bool immediately)
 {
     if (!requesting_save) {
-        printf("Save requested.\n");
+        trace(TRACE_SAVE_REQUEST, 0, 0);
         requesting_save = true;
-        new_data.magic = my_magic;
         requesting_time = time_us_64();
     }
     if (immediately) {
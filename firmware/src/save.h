@@ -15,13 +15,40 @@
 uint32_t board_id_32();
 uint64_t board_id_64();
 
-/* It's safer to lock other I/O ops during saving, so we need a locker */
-typedef void (*io_locker_func)(bool pause);
-void save_init(uint32_t magic, mutex_t *lock);
-
-void save_loop();
-
-void *save_alloc(size_t size, void *def, void (*after_load)());
+/* Records are a page each, the rest of it is header */
+#define SAVE_DATA_SIZE 240
+
+/* version is of the whole saved data, modules migrate from older ones */
+void save_init(uint32_t magic, uint16_t version);
+
+void save_loop(); // programs at most one flash page per call
+void save_idle(); // when input is idle, may erase flash for up to ~100ms
+
+typedef struct {
+    uint32_t count;
+    uint32_t last_us;
+    uint32_t max_us; // core1 parked, core0 interrupts off
+} save_op_stat_t;
+
+typedef struct {
+    save_op_stat_t program;
+    save_op_stat_t erase;
+    uint32_t held; // saves put off until idle erased the next sector
+    uint8_t sector; // where the next record goes
+    uint8_t slot;
+    uint32_t seq; // of the latest record
+    uint16_t version; // of the record loaded at boot
+    uint32_t load_us;
+    uint32_t bad_records; // failed CRC at boot
+} save_stat_t;
+
+void save_get_stat(save_stat_t *stat);
+
+/* migrate runs before after_load when the loaded data is of another
+   version, bytes the old data didn't have come from def. NULL when the
+   data doesn't fit. */
+void *save_alloc(size_t size, void *def, void (*migrate)(uint16_t from),
+                 void (*after_load)());
 void save_request(bool immediately);
 
 #endif
@@ -0,0 +1,307 @@
+/*
+ * Cooperative Deadline Scheduler
+ * WHowe <github.com/whowechina>
+ *
+ * Every task has a release time and a deadline one period later. Among due
+ * tasks the highest priority runs first, then the earliest deadline. A
+ * lower priority task only starts if its budget fits before the next
+ * release of a higher priority one, unless it has already waited a whole
+ * period, so slow background work can't push the scan off its deadline
+ * and can't be starved either.
+ *
+ * Start lateness of every timed run is kept in a log2 histogram, so a
+ * steady pace can be checked under load. A task behind by whole periods
+ * either skips to now or catches up by a bounded number of runs.
+ *
+ * Tasks never preempt each other. A task that has to wait (NFC) calls
+ * sched_run() in its wait loop, which then only runs higher priority tasks.
+ */
+
+#include "sched.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+#include "pico/stdlib.h"
+#include "hardware/structs/xip_ctrl.h"
+
+#include "hot.h"
+
+#define MAX_TASKS 12
+#define NO_TASK -1
+
+typedef struct {
+    const char *name;
+    sched_func_t func;
+    sched_ready_t ready;
+    uint32_t period;
+    uint8_t priority;
+    uint32_t budget;
+    uint64_t release;
+    bool running;
+    uint8_t catchup;
+    uint8_t behind; // back to back runs so far
+    struct {
+        uint32_t runs;
+        uint32_t missed;
+        uint32_t overrun;
+        uint32_t skipped;
+        uint32_t max_us;
+        uint32_t late_max;
+        uint32_t late[SCHED_LATE_BUCKETS];
+        uint32_t xip_acc;
+        uint32_t xip_miss;
+    } stat;
+} task_t;
+
+static task_t tasks[MAX_TASKS];
+static int task_num = 0;
+static int current = NO_TASK;
+
+int sched_add(const char *name, sched_func_t func, sched_ready_t ready,
+              uint32_t period_us, uint8_t priority, uint32_t budget_us)
+{
+    if ((task_num >= MAX_TASKS) || (period_us == 0)) {
+        return -1;
+    }
+
+    task_t *task = &tasks[task_num];
+    memset(task, 0, sizeof(*task));
+    task->name = name;
+    task->func = func;
+    task->ready = ready;
+    task->period = period_us;
+    task->priority = priority;
+    task->budget = budget_us;
+    task->release = time_us_64();
+    return task_num++;
+}
+
+void HOT(sched_next_at)(int id, uint64_t time_us)
+{
+    if ((id >= 0) && (id < task_num)) {
+        tasks[id].release = time_us;
+    }
+}
+
+void HOT(sched_set_period)(int id, uint32_t period_us)
+{
+    if ((id >= 0) && (id < task_num) && (period_us > 0)) {
+        tasks[id].period = period_us;
+    }
+}
+
+void sched_set_catchup(int id, uint8_t max_runs)
+{
+    if ((id >= 0) && (id < task_num)) {
+        tasks[id].catchup = max_runs;
+        tasks[id].behind = 0;
+    }
+}
+
+static inline uint64_t deadline_of(const task_t *task)
+{
+    return task->release + task->period;
+}
+
+static bool HOT(is_due)(task_t *task, uint64_t now)
+{
+    return (now >= task->release) || (task->ready && task->ready());
+}
+
+static bool HOT(more_urgent)(const task_t *a, const task_t *b)
+{
+    if (a->priority != b->priority) {
+        return a->priority < b->priority;
+    }
+    return deadline_of(a) < deadline_of(b);
+}
+
+/* Earliest release of any task that would preempt this one if it could */
+static uint64_t HOT(next_higher_release)(const task_t *task, int ceiling)
+{
+    uint64_t next = UINT64_MAX;
+    for (int i = 0; i < task_num; i++) {
+        const task_t *other = &tasks[i];
+        if (other->running || (other->priority >= task->priority) ||
+            (other->priority >= ceiling)) {
+            continue;
+        }
+        if (other->release < next) {
+            next = other->release;
+        }
+    }
+    return next;
+}
+
+static bool HOT(fits)(const task_t *task, int ceiling, uint64_t now)
+{
+    if ((now > task->release) && (now - task->release >= task->period)) {
+        return true; // waited long enough, run it anyway
+    }
+    return now + task->budget <= next_higher_release(task, ceiling);
+}
+
+static void HOT(record_lateness)(task_t *task, uint64_t late)
+{
+    uint32_t us = late > UINT32_MAX ? UINT32_MAX : late;
+    int bucket = us ? 32 - __builtin_clz(us) : 0;
+    if (bucket >= SCHED_LATE_BUCKETS) {
+        bucket = SCHED_LATE_BUCKETS - 1;
+    }
+    task->stat.late[bucket]++;
+    if (us > task->stat.late_max) {
+        task->stat.late_max = us;
+    }
+}
+
+static void HOT(run)(int id, uint64_t now)
+{
+    task_t *task = &tasks[id];
+    bool timed = (now >= task->release);
+    uint64_t deadline = deadline_of(task);
+
+    /* Release moves on before running, so the task may still override it */
+    if (timed) {
+        record_lateness(task, now - task->release);
+        task->release = deadline;
+        if (task->release > now) {
+            task->behind = 0;
+        } else if (task->behind < task->catchup) {
+            task->behind++; // due again right away
+        } else {
+            while (task->release <= now) {
+                task->release += task->period;
+                task->stat.skipped++;
+            }
+            task->behind = 0;
+        }
+    }
+
+    uint32_t xip_acc = xip_ctrl_hw->ctr_acc;
+    uint32_t xip_hit = xip_ctrl_hw->ctr_hit;
+
+    int parent = current;
+    current = id;
+    task->running = true;
+    task->func();
+    task->running = false;
+    current = parent;
+
+    xip_acc = xip_ctrl_hw->ctr_acc - xip_acc;
+    xip_hit = xip_ctrl_hw->ctr_hit - xip_hit;
+    task->stat.xip_acc += xip_acc;
+    task->stat.xip_miss += xip_acc - xip_hit;
+
+    uint64_t end = time_us_64();
+    uint32_t took = end - now;
+
+    task->stat.runs++;
+    if (took > task->stat.max_us) {
+        task->stat.max_us = took;
+    }
+    if (took > task->budget) {
+        task->stat.overrun++;
+    }
+    if (timed && (end > deadline)) {
+        task->stat.missed++;
+    }
+}
+
+void HOT(sched_run)()
+{
+    int ceiling = (current == NO_TASK) ? 256 : tasks[current].priority;
+    uint64_t now = time_us_64();
+    uint64_t wake = UINT64_MAX;
+    int pick = NO_TASK;
+
+    for (int i = 0; i < task_num; i++) {
+        task_t *task = &tasks[i];
+        if (task->running || (task->priority >= ceiling)) {
+            continue;
+        }
+        if (!is_due(task, now)) {
+            if (task->release < wake) {
+                wake = task->release;
+            }
+            continue;
+        }
+        if ((pick == NO_TASK) || more_urgent(task, &tasks[pick])) {
+            pick = i;
+        }
+    }
+
+    if ((pick != NO_TASK) && fits(&tasks[pick], ceiling, now)) {
+        run(pick, now);
+        return;
+    }
+
+    if (pick != NO_TASK) {
+        uint64_t higher = next_higher_release(&tasks[pick], ceiling);
+        if (higher < wake) {
+            wake = higher;
+        }
+    }
+
+    /* Hardware timer alarm or any interrupt wakes us up, ready() tasks
+       get checked again on the next step */
+    if ((wake != UINT64_MAX) && (wake > now)) {
+        best_effort_wfe_or_timeout(wake);
+    }
+}
+
+int sched_num()
+{
+    return task_num;
+}
+
+int sched_find(const char *name)
+{
+    for (int i = 0; i < task_num; i++) {
+        if (strcasecmp(tasks[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void sched_get_stat(int id, sched_stat_t *stat)
+{
+    if ((id < 0) || (id >= task_num)) {
+        memset(stat, 0, sizeof(*stat));
+        return;
+    }
+
+    const task_t *task = &tasks[id];
+    stat->name = task->name;
+    stat->period = task->period;
+    stat->priority = task->priority;
+    stat->budget = task->budget;
+    stat->runs = task->stat.runs;
+    stat->missed = task->stat.missed;
+    stat->overrun = task->stat.overrun;
+    stat->skipped = task->stat.skipped;
+    stat->max_us = task->stat.max_us;
+    stat->late_max = task->stat.late_max;
+    stat->xip_acc = task->stat.xip_acc;
+    stat->xip_miss = task->stat.xip_miss;
+    stat->catchup = task->catchup;
+}
+
+void sched_get_lateness(int id, uint32_t hist[SCHED_LATE_BUCKETS])
+{
+    if ((id < 0) || (id >= task_num)) {
+        memset(hist, 0, SCHED_LATE_BUCKETS * sizeof(hist[0]));
+        return;
+    }
+    memcpy(hist, tasks[id].stat.late, sizeof(tasks[id].stat.late));
+}
+
+void sched_reset_stat()
+{
+    for (int i = 0; i < task_num; i++) {
+        memset(&tasks[i].stat, 0, sizeof(tasks[i].stat));
+    }
+}
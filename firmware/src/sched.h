@@ -0,0 +1,57 @@
+/*
+ * Cooperative Deadline Scheduler
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef void (*sched_func_t)();
+typedef bool (*sched_ready_t)();
+
+/* Lower priority value runs first. A task is due every period_us, or
+   earlier whenever ready() says so (NULL for purely periodic tasks). */
+int sched_add(const char *name, sched_func_t func, sched_ready_t ready,
+              uint32_t period_us, uint8_t priority, uint32_t budget_us);
+
+void sched_next_at(int id, uint64_t time_us);
+void sched_set_period(int id, uint32_t period_us); // from the next release
+
+/* After a stall a task normally skips the periods it missed and carries
+   on from now. With max_runs > 0 it runs up to that many times back to
+   back to catch up first, then skips the rest. */
+void sched_set_catchup(int id, uint8_t max_runs);
+
+/* One scheduling step: run the most urgent due task or wait for one.
+   Called from inside a task, only higher priority tasks are run. */
+void sched_run();
+
+typedef struct {
+    const char *name;
+    uint32_t period;
+    uint8_t priority;
+    uint32_t budget;
+    uint32_t runs;
+    uint32_t missed; // finished after its deadline
+    uint32_t overrun; // took longer than its budget
+    uint32_t skipped; // periods dropped after a stall
+    uint32_t max_us;
+    uint32_t late_max; // start after release, us
+    uint32_t xip_acc; // XIP cache accesses while running, both cores
+    uint32_t xip_miss;
+    uint8_t catchup;
+} sched_stat_t;
+
+/* Start lateness, bucket 0 is on time (<1us), bucket i is < 2^i us */
+#define SCHED_LATE_BUCKETS 18
+
+int sched_num();
+int sched_find(const char *name);
+void sched_get_stat(int id, sched_stat_t *stat);
+void sched_get_lateness(int id, uint32_t hist[SCHED_LATE_BUCKETS]);
+void sched_reset_stat();
+
+#endif
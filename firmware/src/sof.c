@@ -0,0 +1,191 @@
+/*
+ * USB Start-of-Frame Tracking
+ * WHowe <github.com/whowechina>
+ *
+ * Timestamps every USB SOF so the touch scan can be started at a fixed
+ * phase of the USB frame. The host polls interrupt IN endpoints early in
+ * each frame, so sampling that finishes just before SOF is the freshest.
+ *
+ * The same handler also timestamps OUT transfer completions of the LED and
+ * Aime endpoints, so the time from a host command arriving on one to it
+ * being handled can be measured.
+ */
+
+#include "sof.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/irq.h"
+#include "hardware/structs/usb.h"
+#include "hardware/regs/usb.h"
+
+#include "usb_descriptors.h"
+#include "hot.h"
+
+#define SOF_PERIOD_US 1000
+#define SOF_LOST_US 3000
+
+static volatile uint64_t last_sof = 0;
+static volatile uint32_t sof_count = 0;
+static volatile uint32_t last_rx[SOF_RX_NUM];
+static uint32_t rx_bits[SOF_RX_NUM]; // BUF_STATUS bit of each OUT endpoint
+static uint64_t last_start = 0;
+
+static struct {
+    uint32_t period_jitter_max;
+    uint32_t lead_min;
+    uint32_t lead_max;
+    uint64_t lead_sum;
+    uint32_t lead_num;
+    struct {
+        uint32_t count;
+        uint32_t max;
+        uint64_t sum;
+    } rx[SOF_RX_NUM];
+} stat = { .lead_min = UINT32_MAX };
+
+/* Runs ahead of TinyUSB's handler. Reading SOF_RD clears the SOF interrupt,
+   so TinyUSB never sees it and leaves it enabled. */
+static void HOT(sof_isr)()
+{
+    uint32_t ints = usb_hw->ints;
+
+    if (ints & USB_INTS_BUFF_STATUS_BITS) {
+        uint32_t status = usb_hw->buf_status;
+        for (int i = 0; i < SOF_RX_NUM; i++) {
+            if (status & rx_bits[i]) {
+                last_rx[i] = time_us_32();
+            }
+        }
+    }
+
+    if (!(ints & USB_INTS_DEV_SOF_BITS)) {
+        return;
+    }
+
+    static uint32_t last_frame = 0;
+    uint64_t now = time_us_64();
+    uint32_t frame = usb_hw->sof_rd & USB_SOF_RD_BITS;
+
+    if ((last_sof != 0) && (((frame - last_frame) & USB_SOF_RD_BITS) == 1)) {
+        uint32_t period = now - last_sof;
+        uint32_t deviation = period > SOF_PERIOD_US ? period - SOF_PERIOD_US
+                                                    : SOF_PERIOD_US - period;
+        if (deviation > stat.period_jitter_max) {
+            stat.period_jitter_max = deviation;
+        }
+    }
+
+    last_frame = frame;
+    last_sof = now;
+    sof_count++;
+}
+
+/* BUF_STATUS has IN of endpoint n at bit 2n and OUT at bit 2n + 1 */
+static uint32_t out_bit(enum usb_port port)
+{
+    uint8_t ep = usb_out_ep(port);
+    return ep ? 1u << (ep * 2 + 1) : 0;
+}
+
+void sof_init()
+{
+    rx_bits[SOF_RX_LED] = out_bit(USB_CDC_LED);
+    rx_bits[SOF_RX_AIME] = out_bit(USB_CDC_AIME);
+    irq_add_shared_handler(USBCTRL_IRQ, sof_isr,
+                           PICO_SHARED_IRQ_HANDLER_HIGHEST_ORDER_PRIORITY);
+    hw_set_bits(&usb_hw->inte, USB_INTS_DEV_SOF_BITS);
+}
+
+/* 64-bit timestamp is written by the ISR, retry if it lands in between */
+static uint64_t HOT(read_last_sof)()
+{
+    uint32_t count;
+    uint64_t sof;
+    do {
+        count = sof_count;
+        sof = last_sof;
+    } while (count != sof_count);
+    return sof;
+}
+
+bool HOT(sof_locked)()
+{
+    uint64_t sof = read_last_sof();
+    return (sof != 0) && (time_us_64() - sof < SOF_LOST_US);
+}
+
+/* Next time at offset_us plus whole periods after the last SOF, but never
+   within half a period of the last start, so SOF timestamp jitter can't
+   squeeze in an extra scan. */
+uint64_t HOT(sof_next_start)(uint32_t offset_us, uint32_t period_us)
+{
+    uint64_t now = time_us_64();
+    uint64_t start = read_last_sof() + offset_us % SOF_PERIOD_US;
+    while ((start <= now) || (start < last_start + period_us / 2)) {
+        start += period_us;
+    }
+    last_start = start;
+    return start;
+}
+
+void HOT(sof_mark_sampled)()
+{
+    uint64_t sof = read_last_sof();
+    if (sof == 0) {
+        return;
+    }
+
+    uint64_t now = time_us_64();
+    uint64_t next_sof = sof + SOF_PERIOD_US;
+    while (next_sof <= now) {
+        next_sof += SOF_PERIOD_US;
+    }
+
+    uint32_t lead = next_sof - now;
+    if (lead < stat.lead_min) {
+        stat.lead_min = lead;
+    }
+    if (lead > stat.lead_max) {
+        stat.lead_max = lead;
+    }
+    stat.lead_sum += lead;
+    stat.lead_num++;
+}
+
+void HOT(sof_rx_handled)(int source)
+{
+    if ((source < 0) || (source >= SOF_RX_NUM) || !rx_bits[source]) {
+        return;
+    }
+
+    uint32_t latency = time_us_32() - last_rx[source];
+    stat.rx[source].count++;
+    stat.rx[source].sum += latency;
+    if (latency > stat.rx[source].max) {
+        stat.rx[source].max = latency;
+    }
+}
+
+void sof_get_stat(sof_stat_t *out)
+{
+    out->count = sof_count;
+    out->period_jitter_max = stat.period_jitter_max;
+    out->lead_min = stat.lead_num ? stat.lead_min : 0;
+    out->lead_max = stat.lead_max;
+    out->lead_avg = stat.lead_num ? stat.lead_sum / stat.lead_num : 0;
+    for (int i = 0; i < SOF_RX_NUM; i++) {
+        out->rx[i].count = stat.rx[i].count;
+        out->rx[i].max = stat.rx[i].max;
+        out->rx[i].avg = stat.rx[i].count ? stat.rx[i].sum / stat.rx[i].count : 0;
+    }
+}
+
+void sof_reset_stat()
+{
+    memset(&stat, 0, sizeof(stat));
+    stat.lead_min = UINT32_MAX;
+}
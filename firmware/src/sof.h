@@ -0,0 +1,45 @@
+/*
+ * USB Start-of-Frame Tracking
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef SOF_H
+#define SOF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+void sof_init(); // after tusb_init()
+
+bool sof_locked();
+/* Best when period_us divides 1ms or is a multiple of it */
+uint64_t sof_next_start(uint32_t offset_us, uint32_t period_us);
+void sof_mark_sampled();
+
+enum {
+    SOF_RX_LED,
+    SOF_RX_AIME,
+    SOF_RX_NUM
+};
+
+/* A host command from the last OUT transfer on that source's endpoint
+   has just been handled */
+void sof_rx_handled(int source);
+
+typedef struct {
+    uint32_t count;
+    uint32_t period_jitter_max; // deviation of SOF interval from 1ms
+    uint32_t lead_min; // sampling done to next SOF
+    uint32_t lead_max;
+    uint32_t lead_avg;
+    struct {
+        uint32_t count;
+        uint32_t max; // its OUT transfer IRQ to command handled
+        uint32_t avg;
+    } rx[SOF_RX_NUM];
+} sof_stat_t;
+
+void sof_get_stat(sof_stat_t *stat);
+void sof_reset_stat();
+
+#endif
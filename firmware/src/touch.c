@@ -14,13 +14,16 @@
 #include "bsp/board.h"
 #include "hardware/gpio.h"
 #include "hardware/i2c.h"
+#include "hardware/timer.h"
 
 #include "board_defs.h"
 
 #include "config.h"
 #include "mpr121.h"
+#include "hot.h"
 
 static uint16_t touch[3];
+static uint32_t touch_time;
 static unsigned touch_counts[36];
 
 static uint8_t touch_map[] = TOUCH_MAP;
@@ -110,7 +113,7 @@ void touch_set_map(unsigned sensor, unsigned key)
 
 static uint64_t touch_reading;
 
-static void remap_reading()
+static void HOT(remap_reading)()
 {
     uint64_t map = 0;
     for (int m = 0; m < 3; m++) {
@@ -123,7 +126,7 @@ static void remap_reading()
     touch_reading = map;
 }
 
-static void touch_stat()
+static void HOT(touch_stat)()
 {
     static uint64_t last_reading;
 
@@ -137,8 +140,9 @@ static void touch_stat()
     }
 }
 
-void touch_update()
+void HOT(touch_update)()
 {
+    touch_time = time_us_32();
     touch[0] = mpr121_touched(MPR121_BASE_ADDR) & 0x0fff;
     touch[1] = mpr121_touched(MPR121_BASE_ADDR + 1) & 0x0fff;
     touch[2] = mpr121_touched(MPR121_BASE_ADDR + 2) & 0x0fff;
@@ -157,6 +161,15 @@ bool touch_sensor_ok(unsigned i)
     return false;
 }
 
+bool touch_raw_sensor(unsigned i, uint16_t raw[12])
+{
+    if (i >= 3) {
+        return false;
+    }
+    sensor_ok[i] = mpr121_raw(MPR121_BASE_ADDR + i, raw, 12);
+    return sensor_ok[i];
+}
+
 const uint16_t *touch_raw()
 {
     static uint16_t readout[36] = {0};
@@ -164,7 +177,7 @@ const uint16_t *touch_raw()
     uint16_t buf[36] = {0};
 
     for (int i = 0; i < 3; i++) {
-        sensor_ok[i] = mpr121_raw(MPR121_BASE_ADDR + i, buf + i * 12, 12);
+        touch_raw_sensor(i, buf + i * 12);
     }
     memcpy(readout, buf, sizeof(readout));
 
@@ -199,11 +212,16 @@ bool touch_touched(unsigned key)
     return touch_reading & (1ULL << key);
 }
 
-uint64_t touch_touchmap()
+uint64_t HOT(touch_touchmap)()
 {
     return touch_reading;
 }
 
+uint32_t HOT(touch_sample_time)()
+{
+    return touch_time;
+}
+
 unsigned touch_count(unsigned key)
 {
     if (key >= 34) {
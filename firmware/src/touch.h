@@ -27,9 +27,11 @@ void touch_sensor_init();
 void touch_update();
 bool touch_touched(unsigned key);
 uint64_t touch_touchmap();
+uint32_t touch_sample_time(); // when the current touchmap was read, in us
 void touch_set_map(unsigned sensor, unsigned key);
 
 const uint16_t *touch_raw();
+bool touch_raw_sensor(unsigned i, uint16_t raw[12]); // one MPR121 only
 const uint16_t *map_raw_to_zones(const uint16_t *raw);
 bool touch_sensor_ok(unsigned i);
 
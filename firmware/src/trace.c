@@ -0,0 +1,105 @@
+/*
+ * Binary Event Trace
+ * WHowe <github.com/whowechina>
+ *
+ * Each core writes its own ring, so recording takes no lock: a timer read,
+ * one entry store and a head increment. The ring overwrites its oldest
+ * entries, and readers check the head again after copying an entry to
+ * catch the ones overwritten meanwhile. Unlike printf over USB it never
+ * blocks, so it can stay on without changing the timing being traced.
+ */
+
+#include "trace.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#include "hot.h"
+
+typedef struct {
+    volatile uint32_t head;
+    trace_entry_t entries[TRACE_DEPTH];
+} ring_t;
+
+static ring_t rings[2];
+
+static volatile bool enabled = true;
+
+static const char *names[TRACE_ID_NUM] = {
+    "touch_cmd", "led_cmd", "led_short", "hid_cmd",
+    "save_request", "save_program", "save_erase", "save_load",
+    "save_corrupt", "save_migrate",
+};
+
+void HOT(trace)(trace_id_t id, uint16_t a, uint32_t b)
+{
+    if (!enabled) {
+        return;
+    }
+
+    ring_t *ring = &rings[get_core_num()];
+    uint32_t head = ring->head;
+    trace_entry_t *entry = &ring->entries[head & (TRACE_DEPTH - 1)];
+    entry->ts = time_us_32();
+    entry->id = id;
+    entry->a = a;
+    entry->b = b;
+    __dmb();
+    ring->head = head + 1;
+}
+
+void trace_enable(bool on)
+{
+    enabled = on;
+}
+
+bool trace_enabled()
+{
+    return enabled;
+}
+
+void trace_clear()
+{
+    rings[0].head = 0;
+    rings[1].head = 0;
+}
+
+const char *trace_name(uint16_t id)
+{
+    if (id >= TRACE_ID_NUM) {
+        return "unknown";
+    }
+    return names[id];
+}
+
+uint32_t trace_head(int core)
+{
+    if ((core < 0) || (core > 1)) {
+        return 0;
+    }
+    return rings[core].head;
+}
+
+bool trace_read(int core, uint32_t seq, trace_entry_t *entry)
+{
+    if ((core < 0) || (core > 1)) {
+        return false;
+    }
+
+    uint32_t head = rings[core].head;
+    if ((seq >= head) || (head - seq >= TRACE_DEPTH)) {
+        return false;
+    }
+
+    __dmb();
+    *entry = rings[core].entries[seq & (TRACE_DEPTH - 1)];
+    __dmb();
+
+    /* the writer may have wrapped onto it while copying, the slot of
+       seq + TRACE_DEPTH is being written before head reaches it */
+    return rings[core].head - seq < TRACE_DEPTH;
+}
@@ -0,0 +1,47 @@
+/*
+ * Binary Event Trace
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    TRACE_TOUCH_CMD, // a: command char, b: raw command bytes
+    TRACE_LED_CMD, // a: command, b: first 4 data bytes
+    TRACE_LED_SHORT, // a: frame length
+    TRACE_HID_CMD, // a: command, b: first 4 payload bytes
+    TRACE_SAVE_REQUEST,
+    TRACE_SAVE_PROGRAM, // a: sector << 8 | page, 0 is the head, b: blackout us
+    TRACE_SAVE_ERASE, // a: sector, b: blackout us
+    TRACE_SAVE_LOAD, // a: page, 0xfffe for legacy, 0xffff for default, b: seq
+    TRACE_SAVE_CORRUPT, // a: sector << 8 | slot, b: stored crc
+    TRACE_SAVE_MIGRATE, // a: from version, b: to version
+    TRACE_ID_NUM
+} trace_id_t;
+
+typedef struct {
+    uint32_t ts; // us
+    uint16_t id;
+    uint16_t a;
+    uint32_t b;
+} trace_entry_t;
+
+#define TRACE_DEPTH 256 // per core, power of 2
+
+void trace(trace_id_t id, uint16_t a, uint32_t b);
+void trace_enable(bool on);
+bool trace_enabled();
+void trace_clear();
+
+const char *trace_name(uint16_t id);
+
+/* Entries are numbered since the last clear. Entries older than
+   TRACE_DEPTH are gone, trace_read() fails on them. */
+uint32_t trace_head(int core);
+bool trace_read(int core, uint32_t seq, trace_entry_t *entry);
+
+#endif
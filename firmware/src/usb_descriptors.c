@@ -23,6 +23,8 @@
  *
  */
 
+#include <assert.h>
+
 #include "usb_descriptors.h"
 #include "pico/unique_id.h"
 #include "tusb.h"
@@ -65,35 +67,51 @@ uint8_t const desc_hid_report_nkro[] = {
     MAIPICO_REPORT_DESC_NKRO,
 };
 
+uint8_t const desc_hid_report_touch[] = {
+    MAIPICO_REPORT_DESC_TOUCH,
+};
+
+static const uint8_t *hid_report_desc[] = {
+    [USB_HID_IO4] = desc_hid_report_joy,
+    [USB_HID_NKRO] = desc_hid_report_nkro,
+    [USB_HID_TOUCH] = desc_hid_report_touch,
+};
+
+static int8_t instances[USB_PORT_NUM];
+
+int usb_instance(enum usb_port port)
+{
+    return port < USB_PORT_NUM ? instances[port] : -1;
+}
+
+int usb_hid_port(uint8_t instance)
+{
+    const enum usb_port hid_ports[] = { USB_HID_IO4, USB_HID_NKRO, USB_HID_TOUCH };
+    for (int i = 0; i < count_of(hid_ports); i++) {
+        if (instances[hid_ports[i]] == instance) {
+            return hid_ports[i];
+        }
+    }
+    return -1;
+}
+
 // Invoked when received GET HID REPORT DESCRIPTOR
 // Application return pointer to descriptor
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const* tud_hid_descriptor_report_cb(uint8_t itf)
 {
-    switch (itf) {
-        case 0:
-            return desc_hid_report_joy;
-        case 1:
-            return desc_hid_report_nkro;
-        default:
-            return NULL;
-    }
+    int port = usb_hid_port(itf);
+    return port >= 0 ? hid_report_desc[port] : NULL;
 }
 //--------------------------------------------------------------------+
 // Configuration Descriptor
 //--------------------------------------------------------------------+
 
-enum { ITF_NUM_JOY, ITF_NUM_NKRO,
-       ITF_NUM_CDC_CLI, ITF_NUM_CDC_CLI_DATA,
-       ITF_NUM_CDC_TOUCH, ITF_NUM_CDC_TOUCH_DATA,
-       ITF_NUM_CDC_LED, ITF_NUM_CDC_LED_DATA,
-       ITF_NUM_CDC_AIME, ITF_NUM_CDC_AIME_DATA,
-       ITF_NUM_TOTAL };
-
-#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN +         \
-                          TUD_HID_INOUT_DESC_LEN * 1 +  \
-                          TUD_HID_DESC_LEN * 1 +        \
-                          TUD_CDC_DESC_LEN * 4)
+#define CONFIG_MAX_LEN (TUD_CONFIG_DESC_LEN +         \
+                        TUD_HID_INOUT_DESC_LEN * 1 +  \
+                        TUD_HID_DESC_LEN * 2 +        \
+                        TUD_CDC_DESC_LEN * 4 +        \
+                        TUD_VENDOR_DESC_LEN)
 
 #define EPNUM_JOY 0x81
 #define EPNUM_OUTPUT 0x01
@@ -115,40 +133,168 @@ enum { ITF_NUM_JOY, ITF_NUM_NKRO,
 #define EPNUM_CDC_AIME_OUT 0x0a
 #define EPNUM_CDC_AIME_IN  0x8a
 
-uint8_t const desc_configuration_joy[] = {
-    // Config number, interface count, string index, total length, attribute,
-    // power in mA
-    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN,
-                          TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 200),
+#define EPNUM_TOUCH 0x8b
 
-    // Interface number, string index, protocol, report descriptor len, EP In
-    // address, size & polling interval
-    TUD_HID_INOUT_DESCRIPTOR(ITF_NUM_JOY, 4, HID_ITF_PROTOCOL_NONE,
-                       sizeof(desc_hid_report_joy), EPNUM_OUTPUT, EPNUM_JOY,
-                       CFG_TUD_HID_EP_BUFSIZE, 1),
+#define EPNUM_VENDOR_OUT 0x0c
+#define EPNUM_VENDOR_IN  0x8c
 
-    TUD_HID_DESCRIPTOR(ITF_NUM_NKRO, 5, HID_ITF_PROTOCOL_NONE,
-                       sizeof(desc_hid_report_nkro), EPNUM_KEY,
-                       CFG_TUD_HID_EP_BUFSIZE, 1),
+#define PORT(x) (1 << (x))
+
+static const uint8_t out_eps[USB_PORT_NUM] = {
+    [USB_HID_IO4] = EPNUM_OUTPUT,
+    [USB_CDC_CLI] = EPNUM_CDC_CLI_OUT,
+    [USB_CDC_TOUCH] = EPNUM_CDC_TOUCH_OUT,
+    [USB_CDC_LED] = EPNUM_CDC_LED_OUT,
+    [USB_CDC_AIME] = EPNUM_CDC_AIME_OUT,
+    [USB_VENDOR] = EPNUM_VENDOR_OUT,
+};
 
-    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_CLI, 6, EPNUM_CDC_CLI_NOTIF,
-                       8, EPNUM_CDC_CLI_OUT, EPNUM_CDC_CLI_IN, 64),
+uint8_t usb_out_ep(enum usb_port port)
+{
+    return usb_instance(port) >= 0 ? out_eps[port] : 0;
+}
 
-    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_TOUCH, 7, EPNUM_CDC_TOUCH_NOTIF,
-                       8, EPNUM_CDC_TOUCH_OUT, EPNUM_CDC_TOUCH_IN, 64),
+static const uint16_t profile_ports[] = {
+    [USB_PROFILE_FULL] = PORT(USB_HID_IO4) | PORT(USB_HID_NKRO) |
+                         PORT(USB_CDC_CLI) | PORT(USB_CDC_TOUCH) |
+                         PORT(USB_CDC_LED) | PORT(USB_CDC_AIME) |
+                         PORT(USB_HID_TOUCH), // only with touch_hid.report
+    [USB_PROFILE_ARCADE] = PORT(USB_HID_IO4) | PORT(USB_CDC_CLI) |
+                           PORT(USB_CDC_TOUCH) | PORT(USB_CDC_LED),
+    [USB_PROFILE_PC] = PORT(USB_HID_NKRO) | PORT(USB_CDC_CLI) |
+                       PORT(USB_HID_TOUCH),
+    [USB_PROFILE_DEBUG] = PORT(USB_CDC_CLI) | PORT(USB_HID_TOUCH) |
+                          PORT(USB_VENDOR),
+};
 
-    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_LED, 8, EPNUM_CDC_LED_NOTIF,
-                       8, EPNUM_CDC_LED_OUT, EPNUM_CDC_LED_IN, 64),
+/* Full profile as it was before profiles, it keeps the old revision */
+#define FULL_PORTS (PORT(USB_HID_IO4) | PORT(USB_HID_NKRO) | PORT(USB_CDC_CLI) | \
+                    PORT(USB_CDC_TOUCH) | PORT(USB_CDC_LED) | PORT(USB_CDC_AIME))
 
-    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_AIME, 9, EPNUM_CDC_AIME_NOTIF,
-                       8, EPNUM_CDC_AIME_OUT, EPNUM_CDC_AIME_IN, 64),
+static_assert(USB_PORT_NUM <= 8, "Port layout must fit in the revision's low byte");
+
+static const char *profile_names[] = { "full", "arcade", "pc", "debug" };
+static const char *port_names[] = {
+    "IO4", "NKRO", "CLI", "Touch", "LED", "AIME", "TouchHID", "Vendor"
 };
 
+const char *usb_profile_name(unsigned profile)
+{
+    return profile < USB_PROFILE_NUM ? profile_names[profile] : "?";
+}
+
+const char *usb_port_name(enum usb_port port)
+{
+    return port < USB_PORT_NUM ? port_names[port] : "?";
+}
+
+static uint8_t desc_configuration[CONFIG_MAX_LEN];
+
+#define APPEND(...) {                                             \
+    const uint8_t block[] = { __VA_ARGS__ };                      \
+    memcpy(desc_configuration + len, block, sizeof(block));       \
+    len += sizeof(block);                                         \
+}
+
+/* Ports go in the order of enum usb_port, so the full profile has the same
+   interface numbers as the fixed descriptor it replaced. Class instances
+   are counted in the same order, the command line is always CDC 0 for stdio. */
+void usb_descriptors_build(unsigned profile, bool vendor, bool touch_hid)
+{
+    if (profile >= USB_PROFILE_NUM) {
+        profile = USB_PROFILE_FULL;
+    }
+    uint16_t ports = profile_ports[profile] | PORT(USB_CDC_CLI);
+    if ((profile == USB_PROFILE_FULL) && !touch_hid) {
+        ports &= ~PORT(USB_HID_TOUCH); // opt-in, it's after the others
+    }
+    if (vendor) {
+        ports |= PORT(USB_VENDOR);
+    }
+
+    /* Windows keeps the driver it bound to each interface by VID, PID and
+       revision. Interfaces move around between layouts, so each layout
+       reports a revision of its own and gets its drivers bound afresh. */
+    desc_device_joy.bcdDevice = 0x0100 + (ports ^ FULL_PORTS);
+
+    int len = TUD_CONFIG_DESC_LEN;
+    uint8_t itf = 0;
+    int8_t hid = 0;
+    int8_t cdc = 0;
+    for (int port = 0; port < USB_PORT_NUM; port++) {
+        instances[port] = -1;
+        if (!(ports & PORT(port))) {
+            continue;
+        }
+        switch (port) {
+            case USB_HID_IO4:
+                APPEND(TUD_HID_INOUT_DESCRIPTOR(itf, 4, HID_ITF_PROTOCOL_NONE,
+                       sizeof(desc_hid_report_joy), EPNUM_OUTPUT, EPNUM_JOY,
+                       CFG_TUD_HID_EP_BUFSIZE, 1));
+                instances[port] = hid++;
+                itf += 1;
+                break;
+            case USB_HID_NKRO:
+                APPEND(TUD_HID_DESCRIPTOR(itf, 5, HID_ITF_PROTOCOL_NONE,
+                       sizeof(desc_hid_report_nkro), EPNUM_KEY,
+                       CFG_TUD_HID_EP_BUFSIZE, 1));
+                instances[port] = hid++;
+                itf += 1;
+                break;
+            case USB_CDC_CLI:
+                APPEND(TUD_CDC_DESCRIPTOR(itf, 6, EPNUM_CDC_CLI_NOTIF,
+                       8, EPNUM_CDC_CLI_OUT, EPNUM_CDC_CLI_IN, 64));
+                instances[port] = cdc++;
+                itf += 2;
+                break;
+            case USB_CDC_TOUCH:
+                APPEND(TUD_CDC_DESCRIPTOR(itf, 7, EPNUM_CDC_TOUCH_NOTIF,
+                       8, EPNUM_CDC_TOUCH_OUT, EPNUM_CDC_TOUCH_IN, 64));
+                instances[port] = cdc++;
+                itf += 2;
+                break;
+            case USB_CDC_LED:
+                APPEND(TUD_CDC_DESCRIPTOR(itf, 8, EPNUM_CDC_LED_NOTIF,
+                       8, EPNUM_CDC_LED_OUT, EPNUM_CDC_LED_IN, 64));
+                instances[port] = cdc++;
+                itf += 2;
+                break;
+            case USB_CDC_AIME:
+                APPEND(TUD_CDC_DESCRIPTOR(itf, 9, EPNUM_CDC_AIME_NOTIF,
+                       8, EPNUM_CDC_AIME_OUT, EPNUM_CDC_AIME_IN, 64));
+                instances[port] = cdc++;
+                itf += 2;
+                break;
+            case USB_HID_TOUCH:
+                APPEND(TUD_HID_DESCRIPTOR(itf, 10, HID_ITF_PROTOCOL_NONE,
+                       sizeof(desc_hid_report_touch), EPNUM_TOUCH,
+                       CFG_TUD_HID_EP_BUFSIZE, 1));
+                instances[port] = hid++;
+                itf += 1;
+                break;
+            case USB_VENDOR:
+                APPEND(TUD_VENDOR_DESCRIPTOR(itf, 11, EPNUM_VENDOR_OUT,
+                       EPNUM_VENDOR_IN, 64));
+                instances[port] = 0;
+                itf += 1;
+                break;
+        }
+    }
+
+    // Config number, interface count, string index, total length, attribute,
+    // power in mA
+    const uint8_t header[] = {
+        TUD_CONFIG_DESCRIPTOR(1, itf, 0, len,
+                              TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 200)
+    };
+    memcpy(desc_configuration, header, sizeof(header));
+}
+
 // Invoked when received GET CONFIGURATION DESCRIPTOR
 // Application return pointer to descriptor
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const* tud_descriptor_configuration_cb(uint8_t index) {
-    return desc_configuration_joy;
+    return desc_configuration;
 }
 
 //--------------------------------------------------------------------+
@@ -171,6 +317,8 @@ static const char *string_desc_arr[] = {
     "Mai Pico Touch Port",
     "Mai Pico LED Port",
     "Mai Pico AIME Port",
+    "Mai Pico Touch HID",
+    "Mai Pico Vendor Port",
 };
 
 // Invoked when received GET STRING DESCRIPTOR request
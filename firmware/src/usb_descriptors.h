@@ -146,7 +146,49 @@ enum {
         HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                     \
     HID_COLLECTION_END
 
+/* Vendor touch report, 64-bit touch map (A1 at bit 0) then the sample
+   time in microseconds, both little endian */
+#define MAIPICO_REPORT_DESC_TOUCH                                              \
+    HID_USAGE_PAGE_N(0xffa1, 2),                                               \
+    HID_USAGE(0x01),                                                           \
+    HID_COLLECTION(HID_COLLECTION_APPLICATION),                                \
+        HID_USAGE(0x01),                                                       \
+        HID_LOGICAL_MIN(0), HID_LOGICAL_MAX(255),                              \
+        HID_REPORT_COUNT(12), HID_REPORT_SIZE(8),                              \
+        HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                     \
+    HID_COLLECTION_END
+
 //        HID_REPORT_ID(REPORT_ID_NKRO) 
 
+/* In descriptor order */
+enum usb_port {
+    USB_HID_IO4,
+    USB_HID_NKRO,
+    USB_CDC_CLI,
+    USB_CDC_TOUCH,
+    USB_CDC_LED,
+    USB_CDC_AIME,
+    USB_HID_TOUCH,
+    USB_VENDOR,
+    USB_PORT_NUM
+};
+
+enum usb_profile {
+    USB_PROFILE_FULL, // everything but vendor
+    USB_PROFILE_ARCADE, // IO4, touch and LED ports
+    USB_PROFILE_PC, // NKRO and touch HID
+    USB_PROFILE_DEBUG, // touch HID and vendor
+    USB_PROFILE_NUM
+};
+
+/* Command line port is in every profile, vendor can be added to any.
+   Touch HID is in the full profile only when touch_hid is set. */
+void usb_descriptors_build(unsigned profile, bool vendor, bool touch_hid);
+int usb_instance(enum usb_port port); // class instance, -1 if not present
+int usb_hid_port(uint8_t instance);
+uint8_t usb_out_ep(enum usb_port port); // 0 if not present or no OUT
+const char *usb_profile_name(unsigned profile);
+const char *usb_port_name(enum usb_port port);
+
 void usb_descriptors_disable_io4();
 #endif /* USB_DESCRIPTORS_H_ */
@@ -0,0 +1,277 @@
+/*
+ * Vendor Bulk Interface for Tools
+ * WHowe <github.com/whowechina>
+ *
+ * A small binary request/response protocol on a vendor bulk interface.
+ * Both ways a message is a 6-byte header and a payload:
+ *   cmd, seq, status (0 in requests), reserved, payload length (LE16)
+ * A response echoes cmd and seq. One request is served at a time and a
+ * response may take a few frames to go out, the host should wait for it.
+ *
+ * It runs as a low priority task and does a bounded amount of work each
+ * time, so touch, LED and HID never wait for it.
+ */
+
+#include "vendor.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#include "tusb.h"
+
+#include "config.h"
+#include "save.h"
+#include "touch.h"
+#include "effect.h"
+#include "cli.h"
+#include "prof.h"
+
+#define VENDOR_ITF 0
+#define VENDOR_VERSION 2 // 2: profile carries stage stats
+
+enum {
+    CMD_INFO = 0x01,
+    CMD_CFG_READ = 0x10,
+    CMD_CFG_WRITE = 0x11, // offset (LE16), data
+    CMD_RAW = 0x20,
+    CMD_COUNTERS = 0x21,
+    CMD_PROFILE = 0x22, // core (optional, 0 by default)
+};
+
+enum {
+    STATUS_OK = 0,
+    STATUS_UNKNOWN_CMD = 1,
+    STATUS_BAD_ARGS = 2,
+};
+
+typedef struct __attribute__((packed)) {
+    uint8_t cmd;
+    uint8_t seq;
+    uint8_t status;
+    uint8_t reserved;
+    uint16_t len;
+} vendor_hdr_t;
+
+typedef union {
+    uint8_t raw[320];
+    struct {
+        vendor_hdr_t hdr;
+        uint8_t payload[0];
+    };
+} vendor_msg_t;
+
+static vendor_msg_t request;
+static unsigned rx_len = 0;
+
+static vendor_msg_t response;
+static unsigned tx_pos = 0;
+static unsigned tx_len = 0;
+
+static int raw_sensor = -1; // raw readout in progress, one sensor per frame
+static uint16_t raw_buf[36];
+
+#define PAYLOAD_MAX (sizeof(request.raw) - sizeof(vendor_hdr_t))
+
+static void respond(uint8_t status, const void *payload, unsigned len)
+{
+    response.hdr.cmd = request.hdr.cmd;
+    response.hdr.seq = request.hdr.seq;
+    response.hdr.status = status;
+    response.hdr.reserved = 0;
+    response.hdr.len = len;
+    if (payload && (payload != response.payload)) {
+        memcpy(response.payload, payload, len);
+    }
+    tx_pos = 0;
+    tx_len = sizeof(vendor_hdr_t) + len;
+}
+
+static void cmd_info()
+{
+    struct __attribute__((packed)) {
+        uint8_t version;
+        uint8_t reserved;
+        uint16_t cfg_size;
+        uint64_t board_id;
+        char built[32];
+    } info = { VENDOR_VERSION, 0, sizeof(mai_cfg_t), board_id_64() };
+
+    strncpy(info.built, built_time, sizeof(info.built) - 1);
+    respond(STATUS_OK, &info, sizeof(info));
+}
+
+/* Fields read at run time (colors, HID modes, maps) apply at once, sensor
+   settings apply at next start, same as a config loaded from flash. */
+static void cmd_cfg_write()
+{
+    uint16_t offset;
+    if (request.hdr.len < sizeof(offset)) {
+        respond(STATUS_BAD_ARGS, NULL, 0);
+        return;
+    }
+    memcpy(&offset, request.payload, sizeof(offset));
+    unsigned len = request.hdr.len - sizeof(offset);
+    if (offset + len > sizeof(mai_cfg_t)) {
+        respond(STATUS_BAD_ARGS, NULL, 0);
+        return;
+    }
+
+    memcpy((uint8_t *)mai_cfg + offset, request.payload + sizeof(offset), len);
+    config_validate();
+    config_changed();
+    respond(STATUS_OK, mai_cfg, sizeof(mai_cfg_t));
+}
+
+/* Payload sits at offset 6, so words are built aligned and copied in,
+   M0+ faults on unaligned word stores */
+static void cmd_counters()
+{
+    struct __attribute__((packed)) {
+        uint32_t counts[34];
+        uint16_t fps[2];
+    } counters;
+
+    for (int i = 0; i < 34; i++) {
+        counters.counts[i] = touch_count(i);
+    }
+    counters.fps[0] = cli_fps(0);
+    counters.fps[1] = cli_fps(1);
+    respond(STATUS_OK, &counters, sizeof(counters));
+}
+
+#define PROFILE_EFFECT_MAX 4
+
+/* Effect cycles (last, peak), unused slots are 0, then stage stats of
+   one core in cycles (count, min, mean, max, p99). Stages are in the
+   order of prof_name(). */
+static void cmd_profile()
+{
+    uint8_t core = (request.hdr.len >= 1) ? request.payload[0] : 0;
+    if (core > 1) {
+        respond(STATUS_BAD_ARGS, NULL, 0);
+        return;
+    }
+
+    static struct {
+        uint8_t effect_num;
+        uint8_t stage_num;
+        uint8_t core;
+        uint8_t reserved;
+        uint32_t effects[PROFILE_EFFECT_MAX][2];
+        prof_stat_t stages[PROF_NUM];
+    } profile;
+    static_assert(sizeof(profile) <= PAYLOAD_MAX, "Profile too big for a message");
+    static_assert(sizeof(prof_stat_t) == 5 * 4, "Stage stats are 5 words");
+
+    int num = effect_num();
+    if (num > PROFILE_EFFECT_MAX) {
+        num = PROFILE_EFFECT_MAX;
+    }
+    memset(&profile, 0, sizeof(profile));
+    profile.effect_num = num;
+    profile.stage_num = PROF_NUM;
+    profile.core = core;
+    for (int i = 0; i < num; i++) {
+        effect_cycles(i, &profile.effects[i][0], &profile.effects[i][1]);
+    }
+    for (int i = 0; i < PROF_NUM; i++) {
+        prof_get_stat(core, i, &profile.stages[i]);
+    }
+    respond(STATUS_OK, &profile, sizeof(profile));
+}
+
+static void raw_step()
+{
+    touch_raw_sensor(raw_sensor, raw_buf + raw_sensor * 12);
+    raw_sensor++;
+    if (raw_sensor == 3) {
+        raw_sensor = -1;
+        respond(STATUS_OK, raw_buf, sizeof(raw_buf));
+    }
+}
+
+static void process_request()
+{
+    switch (request.hdr.cmd) {
+        case CMD_INFO:
+            cmd_info();
+            break;
+        case CMD_CFG_READ:
+            respond(STATUS_OK, mai_cfg, sizeof(mai_cfg_t));
+            break;
+        case CMD_CFG_WRITE:
+            cmd_cfg_write();
+            break;
+        case CMD_RAW:
+            raw_sensor = 0; // I2C reads are slow, spread over frames
+            break;
+        case CMD_COUNTERS:
+            cmd_counters();
+            break;
+        case CMD_PROFILE:
+            cmd_profile();
+            break;
+        default:
+            respond(STATUS_UNKNOWN_CMD, NULL, 0);
+            break;
+    }
+}
+
+static void receive()
+{
+    unsigned want = sizeof(vendor_hdr_t);
+    if (rx_len >= sizeof(vendor_hdr_t)) {
+        if (request.hdr.len > PAYLOAD_MAX) {
+            rx_len = 0;
+            tud_vendor_n_read_flush(VENDOR_ITF); // lost sync, start over
+            respond(STATUS_BAD_ARGS, NULL, 0);
+            return;
+        }
+        want += request.hdr.len;
+    }
+
+    if (rx_len < want) {
+        rx_len += tud_vendor_n_read(VENDOR_ITF, request.raw + rx_len, want - rx_len);
+    }
+
+    if ((rx_len >= sizeof(vendor_hdr_t)) &&
+        (rx_len == sizeof(vendor_hdr_t) + request.hdr.len)) {
+        rx_len = 0;
+        process_request();
+    }
+}
+
+static void transmit()
+{
+    unsigned avail = tud_vendor_n_write_available(VENDOR_ITF);
+    unsigned len = tx_len - tx_pos;
+    if (len > avail) {
+        len = avail;
+    }
+    tx_pos += tud_vendor_n_write(VENDOR_ITF, response.raw + tx_pos, len);
+    tud_vendor_n_write_flush(VENDOR_ITF);
+    if (tx_pos >= tx_len) {
+        tx_pos = 0;
+        tx_len = 0;
+    }
+}
+
+void vendor_update()
+{
+    if (!tud_vendor_n_mounted(VENDOR_ITF)) {
+        rx_len = 0;
+        tx_len = 0;
+        raw_sensor = -1;
+        return;
+    }
+
+    if (tx_len) {
+        transmit();
+    } else if (raw_sensor >= 0) {
+        raw_step();
+    } else if (tud_vendor_n_available(VENDOR_ITF)) {
+        receive();
+    }
+}
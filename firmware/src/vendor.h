@@ -0,0 +1,14 @@
+/*
+ * Vendor Bulk Interface for Tools
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef VENDOR_H
+#define VENDOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+void vendor_update();
+
+#endif
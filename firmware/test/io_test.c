@@ -0,0 +1,422 @@
+/*
+ * Host Test for the LED/Touch Port Parser
+ * WHowe <github.com/whowechina>
+ *
+ * Feeds 15070 LED frames and touch commands through io.c's packet parser:
+ * escapes in data and checksum, bad checksums, frames split at every byte
+ * and several frames per packet. Then compares its throughput with the
+ * old byte-at-a-time parser it replaced.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/io.c"
+
+/* Things io.c calls */
+
+mai_cfg_t *mai_cfg;
+static mai_cfg_t test_cfg = { .scan.period = 1000 };
+
+static struct {
+    int count;
+    unsigned index;
+    uint32_t color;
+} button_set;
+
+static uint8_t written[4096];
+static int written_len;
+
+uint64_t time_us_64()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool tud_cdc_n_connected(uint8_t itf) { return true; }
+uint32_t tud_cdc_n_available(uint8_t itf) { return 0; }
+uint32_t tud_cdc_n_read(uint8_t itf, void *buffer, uint32_t bufsize) { return 0; }
+uint32_t tud_cdc_n_write_flush(uint8_t itf) { return 0; }
+
+uint32_t tud_cdc_n_write(uint8_t itf, const void *buffer, uint32_t bufsize)
+{
+    if (written_len + bufsize > sizeof(written)) {
+        written_len = 0;
+    }
+    memcpy(written + written_len, buffer, bufsize);
+    written_len += bufsize;
+    return bufsize;
+}
+
+uint32_t rgb32(uint32_t r, uint32_t g, uint32_t b, bool gamma_fix)
+{
+    return (r << 16) | (g << 8) | b;
+}
+
+uint32_t gray32(uint32_t c, bool gamma_fix)
+{
+    return rgb32(c, c, c, gamma_fix);
+}
+
+void rgb_set_button(unsigned index, uint32_t color, uint8_t speed)
+{
+    button_set.count++;
+    button_set.index = index;
+    button_set.color = color;
+}
+
+void rgb_set_cab(unsigned index, uint32_t color) {}
+void rgb_set_frame(const uint32_t button[8], const uint32_t cab[3]) {}
+uint64_t touch_touchmap() { return 0; }
+void sof_rx_handled(int source) {}
+static uint32_t traced_led_data;
+
+void trace(trace_id_t id, uint16_t a, uint32_t b)
+{
+    if (id == TRACE_LED_CMD) {
+        traced_led_data = b;
+    }
+}
+int usb_instance(enum usb_port port) { return port; }
+
+/* Frame building */
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: ", __func__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            failures++; \
+        } \
+    } while (0)
+
+static int put_escaped(uint8_t *out, uint8_t c)
+{
+    return escape_byte(out, c) - out;
+}
+
+/* SYNC, then escaped dst, src, len, cmd, data and checksum */
+static int make_frame(uint8_t *out, uint8_t cmd, const uint8_t *data,
+                      int data_len, bool bad_checksum)
+{
+    uint8_t raw[4 + 64] = { 1, 2, data_len + 1, cmd };
+    memcpy(raw + 4, data, data_len);
+
+    int n = 0;
+    out[n++] = SYNC;
+    uint8_t checksum = 0;
+    for (int i = 0; i < data_len + 4; i++) {
+        checksum += raw[i];
+        n += put_escaped(out + n, raw[i]);
+    }
+    n += put_escaped(out + n, bad_checksum ? checksum + 1 : checksum);
+    return n;
+}
+
+static int make_set_button(uint8_t *out, uint8_t index, uint8_t r, uint8_t g, uint8_t b)
+{
+    uint8_t data[4] = { index, r, g, b };
+    return make_frame(out, 0x31, data, sizeof(data), false);
+}
+
+static void reset_capture(cdc_t *port)
+{
+    memset(port, 0, sizeof(*port));
+    port->interface = USB_CDC_LED;
+    memset(&button_set, 0, sizeof(button_set));
+    written_len = 0;
+}
+
+static void feed(cdc_t *port, const uint8_t *buf, int len)
+{
+    parse_packet(port, buf, buf + len);
+}
+
+/* Unescapes the first reply and checks its framing and checksum */
+static bool reply_valid(uint8_t expect_cmd)
+{
+    if ((written_len < 1) || (written[0] != SYNC)) {
+        return false;
+    }
+    uint8_t raw[64];
+    int n = 0;
+    for (int i = 1; (i < written_len) && (n < sizeof(raw)); i++) {
+        uint8_t c = written[i];
+        if (c == ESCAPE) {
+            c = written[++i] + 1;
+        } else if (c == SYNC) {
+            break;
+        }
+        raw[n++] = c;
+    }
+    if ((n < 4) || (n < raw[2] + 4)) {
+        return false;
+    }
+    uint8_t checksum = 0;
+    for (int i = 0; i < raw[2] + 3; i++) {
+        checksum += raw[i];
+    }
+    return (checksum == raw[raw[2] + 3]) && (raw[4] == expect_cmd);
+}
+
+/* Cases */
+
+static void test_plain()
+{
+    cdc_t port;
+    reset_capture(&port);
+    uint8_t buf[64];
+    int len = make_set_button(buf, 3, 0x11, 0x22, 0x33);
+    feed(&port, buf, len);
+    CHECK(button_set.count == 1, "count %d", button_set.count);
+    CHECK(button_set.index == 3, "index %u", button_set.index);
+    CHECK(button_set.color == 0x112233, "color %06x", button_set.color);
+    CHECK(reply_valid(0x31), "no valid ack");
+}
+
+static void test_escaped_data()
+{
+    cdc_t port;
+    reset_capture(&port);
+    uint8_t buf[64];
+    int len = make_set_button(buf, 1, SYNC, ESCAPE, SYNC - 1);
+    feed(&port, buf, len);
+    CHECK(button_set.count == 1, "count %d", button_set.count);
+    CHECK(button_set.color == 0xe0d0df, "color %06x", button_set.color);
+}
+
+static void test_escaped_checksum()
+{
+    /* find data that makes the checksum itself need escaping */
+    const uint8_t specials[] = { SYNC, ESCAPE };
+    for (int s = 0; s < count_of(specials); s++) {
+        for (int r = 0; r < 256; r++) {
+            uint8_t sum = 1 + 2 + 5 + 0x31 + 0 + r + 0x40 + 0x40;
+            if (sum != specials[s]) {
+                continue;
+            }
+            cdc_t port;
+            reset_capture(&port);
+            uint8_t buf[64];
+            int len = make_set_button(buf, 0, r, 0x40, 0x40);
+            CHECK(buf[len - 2] == ESCAPE, "checksum not escaped");
+            feed(&port, buf, len);
+            CHECK(button_set.count == 1, "checksum %02x: count %d", sum, button_set.count);
+            CHECK(reply_valid(0x31), "checksum %02x: no valid ack", sum);
+        }
+    }
+}
+
+static void test_bad_checksum()
+{
+    cdc_t port;
+    reset_capture(&port);
+    uint8_t buf[128];
+    uint8_t data[4] = { 2, 0x10, 0x20, 0x30 };
+    int len = make_frame(buf, 0x31, data, 4, true);
+    feed(&port, buf, len);
+    CHECK(button_set.count == 0, "bad frame ran");
+    CHECK(written_len == 0, "bad frame acked");
+
+    /* the next good frame still goes through */
+    len = make_set_button(buf, 4, 1, 2, 3);
+    feed(&port, buf, len);
+    CHECK(button_set.count == 1, "good frame after bad: count %d", button_set.count);
+}
+
+static void test_truncated()
+{
+    cdc_t port;
+    reset_capture(&port);
+    uint8_t buf[128];
+    int len = make_set_button(buf, 5, 1, 2, 3);
+    feed(&port, buf, len - 2); // cut short, then a new SYNC
+    len = make_set_button(buf, 6, 4, 5, 6);
+    feed(&port, buf, len);
+    CHECK(button_set.count == 1, "count %d", button_set.count);
+    CHECK(button_set.index == 6, "index %u", button_set.index);
+}
+
+/* Frames with less than 4 bytes of data only trace their own bytes,
+   not what follows the checksum */
+static void test_short()
+{
+    uint8_t buf[128];
+    for (int data_len = 0; data_len <= 4; data_len++) {
+        cdc_t port;
+        reset_capture(&port);
+        memset(buf, 0xaa, sizeof(buf));
+        uint8_t data[4] = { 0x11, 0x22, 0x33, 0x44 };
+        int len = make_frame(buf, 0x10, data, data_len, false);
+        traced_led_data = 0xffffffff;
+        feed(&port, buf, len);
+
+        uint32_t expect = 0;
+        memcpy(&expect, data, data_len);
+        CHECK(traced_led_data == expect, "%d bytes: traced %08x", data_len, traced_led_data);
+        CHECK(reply_valid(0x10), "%d bytes: no ack", data_len);
+    }
+}
+
+/* Three frames, one escaped, cut into two packets at every byte */
+static void test_split()
+{
+    uint8_t buf[256];
+    int len = make_set_button(buf, 0, 0x01, 0x02, 0x03);
+    len += make_set_button(buf + len, 1, SYNC, 0x05, ESCAPE);
+    len += make_set_button(buf + len, 7, 0x07, 0x08, 0x09);
+
+    for (int cut = 0; cut <= len; cut++) {
+        cdc_t port;
+        reset_capture(&port);
+        feed(&port, buf, cut);
+        feed(&port, buf + cut, len - cut);
+        CHECK(button_set.count == 3, "cut at %d: count %d", cut, button_set.count);
+        CHECK(button_set.index == 7, "cut at %d: index %u", cut, button_set.index);
+        CHECK(button_set.color == 0x070809, "cut at %d: color %06x", cut, button_set.color);
+    }
+
+    cdc_t port;
+    reset_capture(&port);
+    for (int i = 0; i < len; i++) {
+        feed(&port, buf + i, 1);
+    }
+    CHECK(button_set.count == 3, "byte by byte: count %d", button_set.count);
+}
+
+static void test_touch_mixed()
+{
+    cdc_t port;
+    reset_capture(&port);
+    uint8_t buf[64];
+    int len = sizeof("{LAr2}") - 1;
+    memcpy(buf, "{LAr2}", len);
+    feed(&port, buf, len);
+    CHECK((written_len == 6) && (memcmp(written, "(LAr2)", 6) == 0), "touch reply");
+
+    /* touch command right after an LED frame in the same packet */
+    reset_capture(&port);
+    len = make_set_button(buf, 2, 9, 9, 9);
+    memcpy(buf + len, "{RAk1}", 6);
+    len += 6;
+    feed(&port, buf, len);
+    CHECK(button_set.count == 1, "count %d", button_set.count);
+    CHECK((written_len >= 6) && (memcmp(written + written_len - 6, "(RAk1)", 6) == 0),
+          "touch reply after LED frame");
+}
+
+/* The byte-at-a-time parser from before, for comparison. It runs the
+   same led_cmd(), so only parsing differs. */
+static struct {
+    bool in_cmd;
+    bool escape;
+    uint8_t len;
+    uint8_t checksum;
+    led_frame_t frame;
+} ref;
+
+static void ref_feed(cdc_t *port, uint8_t c)
+{
+    if (c == SYNC) {
+        ref.len = 0;
+        ref.in_cmd = true;
+        ref.escape = false;
+        ref.checksum = 0;
+        return;
+    }
+    if (!ref.in_cmd) {
+        return;
+    }
+    if (c == ESCAPE) {
+        ref.escape = true;
+        return;
+    }
+    if (ref.escape) {
+        ref.escape = false;
+        c++;
+    }
+    if ((ref.len == ref.frame.hdr.len + 3) && (ref.checksum == c)) {
+        ref.in_cmd = false;
+        led_cmd(port, &ref.frame);
+        return;
+    }
+    if (ref.len < sizeof(ref.frame.raw)) {
+        ref.frame.raw[ref.len] = c;
+        ref.len++;
+        ref.checksum += c;
+    }
+}
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+#define BENCH_PACKET 64
+
+static void bench()
+{
+    /* what a game sends: mostly plain frames, some with escapes */
+    static uint8_t stream[64 * 1024];
+    int len = 0;
+    for (int i = 0; len + 64 < sizeof(stream); i++) {
+        uint8_t r = (i % 8 == 0) ? SYNC : i;
+        len += make_set_button(stream + len, i % 8, r, i * 3, i * 7);
+    }
+
+    const int rounds = 200;
+    cdc_t port;
+
+    reset_capture(&port);
+    double start = now_us();
+    for (int n = 0; n < rounds; n++) {
+        for (int i = 0; i < len; i += BENCH_PACKET) {
+            int size = len - i < BENCH_PACKET ? len - i : BENCH_PACKET;
+            parse_packet(&port, stream + i, stream + i + size);
+        }
+    }
+    double bulk_us = now_us() - start;
+    int bulk_count = button_set.count;
+
+    reset_capture(&port);
+    memset(&ref, 0, sizeof(ref));
+    start = now_us();
+    for (int n = 0; n < rounds; n++) {
+        for (int i = 0; i < len; i++) {
+            ref_feed(&port, stream[i]);
+        }
+    }
+    double ref_us = now_us() - start;
+    int ref_count = button_set.count;
+
+    CHECK(bulk_count == ref_count, "frames: bulk %d, byte-wise %d", bulk_count, ref_count);
+
+    double total = (double)len * rounds;
+    printf("Parser throughput (host, %d byte packets):\n", BENCH_PACKET);
+    printf("  bulk:      %7.1f bytes/us\n", total / bulk_us);
+    printf("  byte-wise: %7.1f bytes/us\n", total / ref_us);
+}
+
+int main()
+{
+    mai_cfg = &test_cfg;
+
+    test_plain();
+    test_escaped_data();
+    test_escaped_checksum();
+    test_bad_checksum();
+    test_truncated();
+    test_short();
+    test_split();
+    test_touch_mixed();
+    bench();
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,2 @@
+/* Host stand-in, code placement doesn't apply */
+#define __not_in_flash_func(func) func
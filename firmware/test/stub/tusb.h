@@ -0,0 +1,23 @@
+/*
+ * Host stand-in for TinyUSB and the bits of pico-sdk io.c uses
+ */
+
+#ifndef TUSB_H_
+#define TUSB_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define CFG_TUD_CDC_RX_BUFSIZE 64
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+
+uint64_t time_us_64();
+
+bool tud_cdc_n_connected(uint8_t itf);
+uint32_t tud_cdc_n_available(uint8_t itf);
+uint32_t tud_cdc_n_read(uint8_t itf, void *buffer, uint32_t bufsize);
+uint32_t tud_cdc_n_write(uint8_t itf, const void *buffer, uint32_t bufsize);
+uint32_t tud_cdc_n_write_flush(uint8_t itf);
+
+#endif